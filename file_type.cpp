@@ -0,0 +1,296 @@
+/*
+ * Identifies the type of a file from its contents.
+ * Copyright (c) 2026 Benjamin Johnson
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <cctype>       // for isspace()
+
+#include <QtCore>
+#include <QMimeDatabase>
+
+#ifdef Q_OS_UNIX
+#include <sys/stat.h>
+#endif
+
+#include "file_type.h"
+
+namespace {
+
+// The beginning of a file in a format we display
+struct MagicNumber {
+    const char *bytes;
+    int size;
+    FileType::Type type;
+    // Whether it could just as well start a text file, in which case we
+    // only trust it if the file is named like what it says it is
+    bool textual;
+};
+
+const MagicNumber magicNumbers[] = {
+    // Documents
+    {"%PDF-", 5, FileType::PDF, true},
+    {"%!", 2, FileType::PostScript, true},
+    {"\x04%!", 3, FileType::PostScript, false},
+    {"\xc5\xd0\xd3\xc6", 4, FileType::PostScript, false},  // DOS EPS
+
+    // Images
+    {"\x89PNG\r\n\x1a\n", 8, FileType::Image, false},
+    {"\xff\xd8\xff", 3, FileType::Image, false},            // JPEG
+    {"GIF87a", 6, FileType::Image, false},
+    {"GIF89a", 6, FileType::Image, false},
+    {"II*\0", 4, FileType::Image, false},                   // TIFF
+    {"MM\0*", 4, FileType::Image, false},
+    {"BM", 2, FileType::Image, true},                       // BMP
+    {"/* XPM */", 9, FileType::Image, true},
+};
+
+}
+
+QHash<QString, FileType::Entry> FileType::cache;
+QMutex FileType::cacheMutex;
+
+/*
+ * Return the type of the specified file, from the cache if we've seen it
+ * before and it hasn't changed since.
+ */
+FileType::Type FileType::identify(const QString &path)
+{
+    Identity identity;
+    if (!identityOf(path, &identity))
+        return detect(path);
+
+    {
+        QMutexLocker locker(&cacheMutex);
+        QHash<QString, Entry>::const_iterator i =
+            cache.constFind(identity.key);
+        if (i != cache.constEnd() && i->size == identity.size
+            && i->lastModified == identity.lastModified)
+            return i->type;
+    }
+
+    Type type = detect(path);
+
+    QMutexLocker locker(&cacheMutex);
+    // There's no point keeping track of which entries are least recently
+    // used, since a cache miss costs no more than a file read
+    if (cache.size() >= FILE_TYPE_CACHE_SIZE)
+        cache.clear();
+    cache.insert(identity.key,
+                 Entry{identity.size, identity.lastModified, type});
+    return type;
+}
+
+/*
+ * Return the type of the specified file, without using the cache.
+ */
+FileType::Type FileType::detect(const QString &path)
+{
+    QFile file(path);
+    if (file.open(QIODevice::ReadOnly)) {
+        Type type;
+        if (sniff(file.read(FILE_TYPE_HEADER_SIZE), path, &type))
+            return type;
+    }
+
+    // We can't tell, but maybe QMimeDatabase can
+    QMimeDatabase mimeDatabase;
+    return fromMimeType(mimeDatabase.mimeTypeForFile(path));
+}
+
+/*
+ * Return the type of file corresponding to a MIME type.
+ */
+FileType::Type FileType::fromMimeType(const QMimeType &mimeType)
+{
+    // Specific MIME types
+    // List alphabetically by name
+    if (mimeType.inherits("application/oxps")
+        || mimeType.inherits("application/xps"))
+        return XPS;
+    else if (mimeType.inherits("application/pdf"))
+        return PDF;
+    else if (mimeType.inherits("application/postscript"))
+        return PostScript;
+
+    // More generic MIME types
+    // These come last since more specific types may inherit from them
+    else if (mimeType.name().startsWith("image/"))
+        return Image;
+    else if (mimeType.inherits("text/plain"))
+        return Text;
+
+    return Unknown;
+}
+
+/*
+ * Find what identifies a file for the cache, and what tells us whether
+ * it has changed. Returns false if the file isn't there.
+ *
+ * The suffix is part of the key, since it decides between formats that
+ * look alike, and renaming a file doesn't give it a new inode.
+ */
+bool FileType::identityOf(const QString &path, Identity *identity)
+{
+#ifdef Q_OS_UNIX
+    struct stat st;
+    if (stat(QFile::encodeName(path).constData(), &st) != 0)
+        return false;
+
+    identity->key = QString("%1:%2:%3")
+        .arg(st.st_dev)
+        .arg(st.st_ino)
+        .arg(QFileInfo(path).suffix());
+    identity->size = st.st_size;
+    // Whole seconds would miss a file rewritten the moment after we saw it
+#ifdef Q_OS_DARWIN
+    identity->lastModified = (qint64)st.st_mtimespec.tv_sec * 1000000000
+                             + st.st_mtimespec.tv_nsec;
+#else
+    identity->lastModified = (qint64)st.st_mtim.tv_sec * 1000000000
+                             + st.st_mtim.tv_nsec;
+#endif
+    return true;
+#else
+    // Qt doesn't tell us the file ID on other platforms,
+    // so the best we can do is the path
+    QFileInfo info(path);
+    if (!info.exists())
+        return false;
+
+    identity->key = info.canonicalFilePath();
+    identity->size = info.size();
+    identity->lastModified = info.lastModified().toMSecsSinceEpoch();
+    return true;
+#endif
+}
+
+/*
+ * Work out a file's type from its first few bytes, and store it in type.
+ * Returns false if this isn't enough to go on.
+ */
+bool FileType::sniff(const QByteArray &header, const QString &path,
+                     Type *type)
+{
+    // An empty file is whatever its name says, like an empty text file
+    // the user is about to write notes in
+    if (header.isEmpty())
+        return false;
+
+    // Text can start with almost anything, so if a file reads as text,
+    // its name has to agree with its contents, or else we leave it to
+    // QMimeDatabase to weigh the two. A .txt that starts with a pasted
+    // PostScript snippet is still a text file.
+    bool isText = looksLikeText(header);
+    for (const MagicNumber &magic : magicNumbers) {
+        if (header.startsWith(QByteArray::fromRawData(magic.bytes,
+                                                      magic.size))) {
+            if (magic.textual && isText && !isNamedLike(path, magic.type))
+                return false;
+            *type = magic.type;
+            return true;
+        }
+    }
+
+    // Some PDF writers put junk before the header, which readers allow
+    // anywhere in the first kilobyte. Text that merely mentions it, like
+    // a script that writes PDFs, isn't one unless it's named like one.
+    if (header.contains("%PDF-") && (!isText || isNamedLike(path, PDF))) {
+        *type = PDF;
+        return true;
+    }
+
+    // WebP images are RIFF containers, like many other formats
+    if (header.startsWith("RIFF") && header.mid(8, 4) == "WEBP") {
+        *type = Image;
+        return true;
+    }
+
+    // XPS documents are zip archives, which we can only tell apart from
+    // other zip-based formats by name
+    if (header.startsWith("PK\x03\x04")) {
+        QString suffix = QFileInfo(path).suffix().toLower();
+        if (suffix == "xps" || suffix == "oxps") {
+            *type = XPS;
+            return true;
+        }
+        return false;
+    }
+
+    if (isText) {
+        int start = header.startsWith("\xef\xbb\xbf") ? 3 : 0;
+        while (start < header.size() && isspace((uchar)header[start]))
+            ++start;
+        QByteArray text = QByteArray::fromRawData(header.constData() + start,
+                                                  header.size() - start);
+
+        // Markup could be an SVG image or any number of other things
+        if (text.startsWith('<'))
+            return false;
+
+        // X bitmaps and plain PNM images look too much like source code
+        // and notes to go by their contents alone
+        if (text.startsWith("#define") || looksLikePlainPNM(text)) {
+            if (!isNamedLike(path, Image))
+                return false;
+            *type = Image;
+            return true;
+        }
+
+        *type = Text;
+        return true;
+    }
+
+    return false;   // binary, but not anything we know of
+}
+
+/*
+ * Return whether the specified file's name says it's of the specified type.
+ * This is only a matter of matching its suffix against QMimeDatabase's
+ * patterns, without reading anything.
+ */
+bool FileType::isNamedLike(const QString &path, Type type)
+{
+    QMimeDatabase mimeDatabase;
+    return fromMimeType(mimeDatabase.mimeTypeForFile(
+        path, QMimeDatabase::MatchExtension)) == type;
+}
+
+/*
+ * Return whether the specified text starts like a PBM, PGM or PPM image
+ * stored as ASCII, which is the letter P, a digit from 1 to 3, and
+ * whitespace.
+ */
+bool FileType::looksLikePlainPNM(const QByteArray &text)
+{
+    return (text.size() > 2 && text[0] == 'P' && '1' <= text[1]
+            && text[1] <= '3' && isspace((uchar)text[2]));
+}
+
+/*
+ * Return whether the specified bytes look like the beginning of a text
+ * file, meaning they have no control characters a text file wouldn't.
+ */
+bool FileType::looksLikeText(const QByteArray &header)
+{
+    for (int i = 0; i < header.size(); ++i) {
+        uchar c = header[i];
+        if (c < 0x20 && c != '\b' && c != '\t' && c != '\n' && c != '\v'
+            && c != '\f' && c != '\r' && c != 0x1b)
+            return false;
+    }
+    return true;
+}
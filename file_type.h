@@ -0,0 +1,84 @@
+/*
+ * Identifies the type of a file from its contents.
+ * Copyright (c) 2026 Benjamin Johnson
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef FILE_TYPE_H
+#define FILE_TYPE_H
+
+#include <QByteArray>
+#include <QHash>
+#include <QMimeType>
+#include <QMutex>
+#include <QString>
+
+// How much of the beginning of a file to look at
+#define FILE_TYPE_HEADER_SIZE 1024
+// How many files to remember the types of
+#define FILE_TYPE_CACHE_SIZE 4096
+
+/*
+ * Decides which renderer to use for a file.
+ *
+ * QMimeDatabase knows about far more formats than we can display, and
+ * looking a file up there means matching its name against hundreds of
+ * patterns and its contents against hundreds of magic numbers. Instead we
+ * read the first few bytes and compare them to a short table of the
+ * formats we actually render, only asking QMimeDatabase when that isn't
+ * enough to tell: empty files, zip archives that aren't named like XPS
+ * documents, markup that might be an SVG image, text that starts like
+ * another format but isn't named like one, and binary files we don't
+ * recognize.
+ *
+ * identify() also remembers the types of the last few thousand files,
+ * keyed by their device and inode number where available, so files that
+ * are renamed or opened again aren't read again unless they've changed.
+ */
+class FileType
+{
+public:
+    // What kind of renderer a file needs
+    enum Type { Unknown, Image, PDF, PostScript, Text, XPS };
+
+    static Type identify(const QString &path);
+    static Type detect(const QString &path);
+    static Type fromMimeType(const QMimeType &mimeType);
+
+private:
+    struct Identity {
+        QString key;
+        qint64 size;
+        qint64 lastModified;    // only ever compared, so any unit will do
+    };
+    struct Entry {
+        qint64 size;
+        qint64 lastModified;
+        Type type;
+    };
+
+    static bool identityOf(const QString &path, Identity *identity);
+    static bool sniff(const QByteArray &header, const QString &path,
+                      Type *type);
+    static bool isNamedLike(const QString &path, Type type);
+    static bool looksLikeText(const QByteArray &header);
+    static bool looksLikePlainPNM(const QByteArray &text);
+
+    static QHash<QString, Entry> cache;
+    static QMutex cacheMutex;
+};
+
+#endif /* FILE_TYPE_H */
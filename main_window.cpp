@@ -23,6 +23,7 @@
 
 #include "renamifier.h"
 #include "main_window.h"
+#include "renderer_cache.h"
 #include "settings_dialog.h"
 
 MainWindow::MainWindow(QWidget *parent, Qt::WindowFlags f)
@@ -103,6 +104,7 @@ void MainWindow::browseForFiles()
 void MainWindow::closeAll()
 {
     viewer->clear();
+    viewer->prefetch(QStringList());
     nameEntry->clear();
     fileNames.clear();
     currentFileIndex = -1;
@@ -134,6 +136,7 @@ void MainWindow::displayFile(int index)
 
         QString path = fileNames[currentFileIndex];
         viewer->display(path);
+        prefetchUpcoming();
 
         QFileInfo fi(path);
         nameEntry->setText(fi.completeBaseName());
@@ -379,6 +382,23 @@ void MainWindow::dropEvent(QDropEvent *event)
     }
 }
 
+/*
+ * Prefetch the files that displayNext() will show.
+ */
+void MainWindow::prefetchUpcoming()
+{
+    QSettings settings;
+    int prefetchCount = settings.value("prefetch/files",
+                                       DEFAULT_PREFETCH_FILES).toInt();
+
+    // Stop before we wrap around to the current file
+    QStringList upcoming;
+    int fileCount = fileNames.size();
+    for (int i = 1; i <= prefetchCount && i < fileCount; ++i)
+        upcoming << fileNames[(currentFileIndex + i) % fileCount];
+    viewer->prefetch(upcoming);
+}
+
 /*
  * Performs some basic sanity checks before a rename operation.
  * The operation should fail silently if this returns false.
@@ -485,11 +505,14 @@ bool MainWindow::rename_(const QString &srcPath, const QString &dstPath)
 
     // Stop any active render, since that may have placed a lock on the file
     viewer->unloadRenderer();
+    viewer->releaseFile(srcPath);
 
     QFile srcFile(srcPath);
     if (srcFile.rename(dstPath)) {
         // Update the list of open files
         fileNames[currentFileIndex] = dstPath;
+        // Keep what we've already rendered in case the user comes back
+        viewer->fileRenamed(srcPath, dstPath);
         return true;
     } else {
         QString message;
@@ -513,7 +536,7 @@ void MainWindow::showSettingsDialog()
         // Re-display the current file in case we changed the path to
         // one of the helper programs needed to render it
         if (!fileNames.isEmpty())
-            viewer->display(fileNames[currentFileIndex]);
+            viewer->reload(fileNames[currentFileIndex]);
     }
 }
 
@@ -82,6 +82,7 @@ private:
     void displayNextOrPromptToExit();
     void dragEnterEvent(QDragEnterEvent *event);
     void dropEvent(QDropEvent *event);
+    void prefetchUpcoming();
     // The rename methods are protected because they should only be triggered
     // interactively by the user, not programatically.
     bool processRename();
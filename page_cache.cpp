@@ -0,0 +1,129 @@
+/*
+ * Memory-limited cache of rendered page images.
+ * Copyright (c) 2026 Benjamin Johnson
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <QtCore>
+
+#include "page_cache.h"
+
+PageCacheKey::PageCacheKey(const void *renderer, int page, int tile,
+                           int zoomFactor, int dpiX, int dpiY,
+                           qreal devicePixelRatio)
+{
+    this->renderer = renderer;
+    this->page = page;
+    this->tile = tile;
+    this->zoomFactor = zoomFactor;
+    this->dpiX = dpiX;
+    this->dpiY = dpiY;
+    this->devicePixelRatio = devicePixelRatio;
+}
+
+bool PageCacheKey::operator==(const PageCacheKey &other) const
+{
+    return (renderer == other.renderer
+            && page == other.page
+            && tile == other.tile
+            && zoomFactor == other.zoomFactor
+            && dpiX == other.dpiX
+            && dpiY == other.dpiY
+            && devicePixelRatio == other.devicePixelRatio);
+}
+
+size_t qHash(const PageCacheKey &key, size_t seed)
+{
+    return qHashMulti(seed, key.renderer, key.page, key.tile,
+                      key.zoomFactor, key.dpiX, key.dpiY,
+                      key.devicePixelRatio);
+}
+
+/* ------------------------------------------------------------------------ */
+
+PageCache::Statistics PageCache::stats = {0, 0, 0};
+
+PageCache::PageCache()
+{
+    loadSettings();
+}
+
+void PageCache::loadSettings()
+{
+    QSettings settings;
+    qint64 limit = settings.value("cache/pageMemoryLimit",
+                                  DEFAULT_PAGE_CACHE_MEMORY).toLongLong();
+
+    // Costs are in bytes, so this can discard images right away
+    qsizetype before = cache.count();
+    cache.setMaxCost(limit * 1048576);
+    stats.evictions += before - cache.count();
+}
+
+void PageCache::insert(const PageCacheKey &key, const QImage &image)
+{
+    if (image.isNull())
+        return;
+    missed.remove(key);
+
+    // QCache doesn't tell us what it evicts, but we can work it out
+    qsizetype before = cache.count() + (cache.contains(key) ? 0 : 1);
+    if (!cache.insert(key, new QImage(image), image.sizeInBytes()))
+        ++stats.evictions;  // too big to keep at all
+    else
+        stats.evictions += before - cache.count();
+}
+
+/*
+ * Remove the specified image from the cache and return it,
+ * or return a null image if we don't have it.
+ */
+QImage PageCache::take(const PageCacheKey &key)
+{
+    QImage *image = cache.take(key);
+    if (image == nullptr) {
+        if (!missed.contains(key)) {
+            // There's no point keeping track of which are oldest, since
+            // forgetting one at worst counts it twice
+            if (missed.size() >= PAGE_CACHE_MISSES_KEPT)
+                missed.clear();
+            missed.insert(key);
+            ++stats.misses;
+        }
+        return QImage();
+    }
+
+    ++stats.hits;
+    QImage result = *image;
+    delete image;
+    return result;
+}
+
+/*
+ * Discard everything rendered by the specified renderer.
+ * Call this before deleting it, since another one may reuse its address.
+ */
+void PageCache::removeRenderer(const void *renderer)
+{
+    QList<PageCacheKey> keys = cache.keys();
+    for (int i = 0; i < keys.size(); ++i) {
+        if (keys[i].renderer == renderer)
+            cache.remove(keys[i]);
+    }
+    missed.removeIf([renderer](const PageCacheKey &key) {
+        return key.renderer == renderer;
+    });
+}
@@ -0,0 +1,96 @@
+/*
+ * Memory-limited cache of rendered page images.
+ * Copyright (c) 2026 Benjamin Johnson
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef PAGE_CACHE_H
+#define PAGE_CACHE_H
+
+#include <QCache>
+#include <QImage>
+#include <QSet>
+
+// Default settings
+#define DEFAULT_PAGE_CACHE_MEMORY 64    // MiB
+
+// How many missing images to remember, so we count each miss only once
+#define PAGE_CACHE_MISSES_KEPT 4096
+
+/*
+ * Identifies a rendered page image, including everything that affects
+ * what it looks like.
+ */
+struct PageCacheKey {
+    PageCacheKey(const void *renderer, int page, int tile,
+                 int zoomFactor, int dpiX, int dpiY, qreal devicePixelRatio);
+    bool operator==(const PageCacheKey &other) const;
+
+    const void *renderer;   // only compared, never dereferenced
+    int page;
+    int tile;               // or -1 for the whole page
+    int zoomFactor;
+    int dpiX, dpiY;
+    qreal devicePixelRatio;
+};
+
+size_t qHash(const PageCacheKey &key, size_t seed = 0);
+
+/*
+ * Keeps page images the viewer doesn't currently need, in case it
+ * needs them again soon.
+ *
+ * The cache holds up to the number of MiB in the "cache/pageMemoryLimit"
+ * setting, discarding the least recently used images first. Call
+ * loadSettings() to pick up changes.
+ *
+ * Images are take()n out of the cache when they're used again, so
+ * something is only ever in the cache or on screen, never both.
+ *
+ * Hit, miss, and eviction counts are kept across all caches so they can
+ * be used to size the memory limit. The viewer looks for a page every time
+ * it refreshes until the page is rendered, so asking again for an image
+ * we've already missed doesn't count as another miss.
+ */
+class PageCache
+{
+public:
+    struct Statistics {
+        qint64 hits;
+        qint64 misses;
+        qint64 evictions;
+    };
+
+    PageCache();
+
+    void loadSettings();
+    void insert(const PageCacheKey &key, const QImage &image);
+    QImage take(const PageCacheKey &key);
+    void removeRenderer(const void *renderer);
+
+    inline bool contains(const PageCacheKey &key) const
+        { return cache.contains(key); }
+    inline qint64 memoryLimit() const { return cache.maxCost(); }
+
+    static inline Statistics statistics() { return stats; }
+
+private:
+    QCache<PageCacheKey, QImage> cache;
+    QSet<PageCacheKey> missed;      // not in the cache since we looked
+    static Statistics stats;
+};
+
+#endif /* PAGE_CACHE_H */
@@ -0,0 +1,356 @@
+/*
+ * Persistent cache of first-page previews.
+ * Copyright (c) 2026 Benjamin Johnson
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <algorithm>    // for std::max()
+#include <memory>       // for std::shared_ptr
+
+#include <QtCore>
+#include <QImageReader>
+#include <QImageWriter>
+
+#ifdef Q_OS_UNIX
+#include <sys/stat.h>
+#endif
+
+#include "preview_cache.h"
+#include "render_scheduler.h"
+
+// Bump this if the preview format changes, so old previews are ignored
+#define PREVIEW_VERSION 1
+
+// Amount of data at each end of a file to hash in contentKey()
+#define CONTENT_SAMPLE_SIZE 65536
+
+static QFuture<QImage> finished(const QImage &image);
+static void runInBackground(RenderScheduler::Priority priority,
+                            const std::function<void()> &task);
+
+QHash<QString, QString> PreviewCache::contentKeys;
+QMutex PreviewCache::contentKeysMutex;
+
+PreviewCache::PreviewCache()
+{
+    dir = QStandardPaths::writableLocation(QStandardPaths::CacheLocation);
+    if (!dir.isEmpty()) {
+        dir = QDir(dir).filePath("previews");
+        QDir().mkpath(dir);
+    }
+}
+
+/*
+ * Return the cached preview for the specified file, or a null image if we
+ * don't have one. The future is ready right away if we can tell that
+ * without reading anything.
+ */
+QFuture<QImage> PreviewCache::find(const QString &path,
+                                   const RenderParameters &parameters)
+{
+    if (dir.isEmpty() || diskLimit() == 0)
+        return finished(QImage());
+
+    QString identity = identityKey(path);
+    if (identity.isEmpty())
+        return finished(QImage());  // the file isn't there
+
+    // Even a preview we saved for this exact file has to be decoded, and
+    // that shouldn't hold up everything else on this thread either
+    std::shared_ptr<QPromise<QImage>> promise =
+        std::make_shared<QPromise<QImage>>();
+    promise->start();
+    QString dir = this->dir;
+    QString params = parametersKey(parameters);
+    qreal dpRatio = parameters.devicePixelRatio;
+    runInBackground(RenderScheduler::Visible,
+        [promise, dir, path, identity, params, dpRatio]() {
+            // The link tells us which preview we saved for this file
+            QString linkName = QDir(dir).filePath(hashKey(identity + params)
+                                                  + ".link");
+            QString previewName;
+            QFile link(linkName);
+            if (link.open(QIODevice::ReadOnly))
+                previewName = QString::fromLatin1(link.readAll()).trimmed();
+
+            QImage preview;
+            if (!previewName.isEmpty())
+                preview = loadPreview(QDir(dir).filePath(previewName));
+            if (!preview.isNull()) {
+                preview.setDevicePixelRatio(dpRatio);
+                promise->addResult(preview);
+                promise->finish();
+                return;
+            }
+
+            // Maybe we've seen the same contents under another identity.
+            // Hashing them means reading much more, so the page the user
+            // is waiting for goes first.
+            runInBackground(RenderScheduler::Adjacent,
+                [promise, dir, path, identity, params, linkName, dpRatio]() {
+                    QImage preview;
+                    QString content = contentKey(path, identity);
+                    if (!content.isEmpty()) {
+                        QString previewName =
+                            hashKey(content + params) + ".png";
+                        preview =
+                            loadPreview(QDir(dir).filePath(previewName));
+                        if (!preview.isNull()) {
+                            writeFile(linkName, previewName.toLatin1());
+                            preview.setDevicePixelRatio(dpRatio);
+                        }
+                    }
+                    promise->addResult(preview);
+                    promise->finish();
+                });
+        });
+    return promise->future();
+}
+
+/*
+ * Save a preview of the specified file in the background.
+ */
+void PreviewCache::store(const QString &path,
+                         const RenderParameters &parameters,
+                         const QImage &image)
+{
+    qint64 limit = diskLimit();
+    if (dir.isEmpty() || limit == 0 || image.isNull())
+        return;
+
+    // The file may be renamed or deleted by the time the background task
+    // gets around to it, but find() has usually hashed it already
+    QString identity = identityKey(path);
+    if (identity.isEmpty())
+        return;
+    QString params = parametersKey(parameters);
+    QString linkName = QDir(dir).filePath(hashKey(identity + params)
+                                          + ".link");
+    if (QFileInfo::exists(linkName))
+        return;     // we already have this one
+    QString content = knownContentKey(identity);
+
+    // This is the least urgent work we have, and it's fine to lose it if
+    // we quit before getting to it
+    QString dir = this->dir;
+    runInBackground(RenderScheduler::Background,
+        [dir, path, identity, content, params, linkName, image, limit]() {
+            QString key = content.isEmpty() ? contentKey(path, identity)
+                                            : content;
+            if (key.isEmpty())
+                return;
+            QString previewName = hashKey(key + params) + ".png";
+            QString fileName = QDir(dir).filePath(previewName);
+            if (!QFileInfo::exists(fileName)) {
+                QBuffer buffer;
+                buffer.open(QIODevice::WriteOnly);
+                // Favor speed over size; these are small anyway
+                QImageWriter writer(&buffer, "png");
+                writer.setQuality(90);
+                if (!writer.write(image))
+                    return;
+                writeFile(fileName, buffer.data());
+            }
+            writeFile(linkName, previewName.toLatin1());
+            evict(dir, limit);
+        });
+}
+
+qint64 PreviewCache::diskLimit()
+{
+    QSettings settings;
+    qint64 limit = settings.value("cache/previewDiskSpace",
+                                  DEFAULT_PREVIEW_DISK_SPACE).toLongLong();
+    return limit * 1048576;     // convert MiB to bytes
+}
+
+/*
+ * Identify a file by where it lives on disk and when it was modified.
+ * Returns an empty string if the file doesn't exist.
+ */
+QString PreviewCache::identityKey(const QString &path)
+{
+    QFileInfo info(path);
+    if (!info.exists())
+        return QString();
+
+    QString key = QString("%1:%2")
+        .arg(info.size())
+        .arg(info.lastModified().toMSecsSinceEpoch());
+
+#ifdef Q_OS_UNIX
+    struct stat st;
+    if (stat(QFile::encodeName(path).constData(), &st) == 0)
+        return key + QString(":%1:%2").arg(st.st_dev).arg(st.st_ino);
+#endif
+    // Qt doesn't tell us the file ID on other platforms,
+    // so the best we can do is the path
+    return key + ":" + info.canonicalFilePath();
+}
+
+/*
+ * Identify a file by its contents.
+ *
+ * Hashing whole files would take too long for large documents, so we only
+ * hash the beginning and end. Together with the size, this is more than
+ * enough to tell documents apart in practice.
+ */
+QString PreviewCache::contentKey(const QString &path)
+{
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly))
+        return QString();
+
+    QCryptographicHash hash(QCryptographicHash::Sha1);
+    hash.addData(QByteArray::number(file.size()));
+    hash.addData(file.read(CONTENT_SAMPLE_SIZE));
+    if (file.size() > CONTENT_SAMPLE_SIZE) {
+        file.seek(std::max(file.size() - CONTENT_SAMPLE_SIZE,
+                           (qint64)CONTENT_SAMPLE_SIZE));
+        hash.addData(file.read(CONTENT_SAMPLE_SIZE));
+    }
+    return QString::fromLatin1(hash.result().toHex());
+}
+
+/*
+ * Identify a file by its contents, and remember that for its identity.
+ */
+QString PreviewCache::contentKey(const QString &path, const QString &identity)
+{
+    QString key = knownContentKey(identity);
+    if (!key.isEmpty())
+        return key;
+
+    key = contentKey(path);
+    if (key.isEmpty())
+        return key;
+
+    QMutexLocker locker(&contentKeysMutex);
+    if (contentKeys.size() >= PREVIEW_CONTENT_KEYS_KEPT)
+        contentKeys.clear();
+    contentKeys.insert(identity, key);
+    return key;
+}
+
+/*
+ * Return the content key of a file we've already hashed,
+ * or an empty string if we haven't.
+ */
+QString PreviewCache::knownContentKey(const QString &identity)
+{
+    QMutexLocker locker(&contentKeysMutex);
+    return contentKeys.value(identity);
+}
+
+QString PreviewCache::parametersKey(const RenderParameters &parameters)
+{
+    return QString("/v%1/%2/%3x%4/%5")
+        .arg(PREVIEW_VERSION)
+        .arg(parameters.zoomFactor)
+        .arg(parameters.dpiX).arg(parameters.dpiY)
+        .arg(parameters.devicePixelRatio);
+}
+
+/*
+ * Turn a key into something we can use as a file name.
+ */
+QString PreviewCache::hashKey(const QString &key)
+{
+    return QString::fromLatin1(
+        QCryptographicHash::hash(key.toUtf8(),
+                                 QCryptographicHash::Sha1).toHex());
+}
+
+/*
+ * Load a preview and mark it as recently used.
+ */
+QImage PreviewCache::loadPreview(const QString &fileName)
+{
+    QImage preview;
+    QImageReader reader(fileName, "png");
+    if (!reader.read(&preview))
+        return QImage();
+
+    // Eviction goes by modification time
+    QFile file(fileName);
+    if (file.open(QIODevice::Append))
+        file.setFileTime(QDateTime::currentDateTime(),
+                         QFileDevice::FileModificationTime);
+    return preview;
+}
+
+/*
+ * Write a file atomically, so other instances never see it half-written.
+ */
+void PreviewCache::writeFile(const QString &fileName, const QByteArray &data)
+{
+    QSaveFile file(fileName);
+    if (file.open(QIODevice::WriteOnly)) {
+        file.write(data);
+        file.commit();
+    }
+}
+
+/*
+ * Discard the least recently used files until we're under the limit.
+ */
+void PreviewCache::evict(const QString &dir, qint64 limit)
+{
+    // If another instance is already doing this, let it
+    QLockFile lock(QDir(dir).filePath("evict.lock"));
+    if (!lock.tryLock(0))
+        return;
+
+    QFileInfoList files = QDir(dir).entryInfoList(
+        QStringList() << "*.png" << "*.link",
+        QDir::Files, QDir::Time | QDir::Reversed);  // oldest first
+
+    qint64 total = 0;
+    for (int i = 0; i < files.size(); ++i)
+        total += files[i].size();
+
+    for (int i = 0; i < files.size() && total > limit; ++i) {
+        // Someone else may have beaten us to it, which is fine
+        QFile::remove(files[i].filePath());
+        total -= files[i].size();
+    }
+}
+
+/*
+ * Return a future that already has the specified image.
+ */
+QFuture<QImage> finished(const QImage &image)
+{
+    QPromise<QImage> promise;
+    promise.start();
+    promise.addResult(image);
+    promise.finish();
+    return promise.future();
+}
+
+/*
+ * Run a task on the render threads, or on Qt's own thread pool if there
+ * aren't any.
+ */
+void runInBackground(RenderScheduler::Priority priority,
+                     const std::function<void()> &task)
+{
+    RenderScheduler *scheduler = RenderScheduler::instance();
+    if (scheduler != nullptr)
+        scheduler->run(priority, nullptr, task);
+    else
+        QThreadPool::globalInstance()->start(task);
+}
@@ -0,0 +1,94 @@
+/*
+ * Persistent cache of first-page previews.
+ * Copyright (c) 2026 Benjamin Johnson
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef PREVIEW_CACHE_H
+#define PREVIEW_CACHE_H
+
+#include <QFuture>
+#include <QHash>
+#include <QImage>
+#include <QMutex>
+#include <QString>
+
+#include "renderer_cache.h"     // for RenderParameters
+
+// Default settings
+#define DEFAULT_PREVIEW_DISK_SPACE 256  // MiB
+
+// How many files to remember the content hashes of
+#define PREVIEW_CONTENT_KEYS_KEPT 256
+
+/*
+ * Saves the first page of each file the user views to disk, so it can be
+ * displayed instantly the next time while the file itself loads.
+ *
+ * Previews live in the "previews" subdirectory of the user's cache
+ * directory, and are found by the file's identity: its device and inode
+ * number where available, size, and modification time. If that changes
+ * but the contents don't, as when a file is copied or moved to another
+ * drive, a hash of the contents finds it instead. Previews are also keyed
+ * by the parameters they were rendered with.
+ *
+ * The cache is limited to the number of MiB in the "cache/previewDiskSpace"
+ * setting, discarding the least recently used previews first. A limit of
+ * zero turns the cache off.
+ *
+ * Several instances of the program can share the cache. Files are written
+ * atomically, and anything that goes missing while we're using it is
+ * simply treated as a miss.
+ *
+ * Only the identity is looked up on the calling thread, since that's no
+ * more than a stat(). Reading and decoding the preview happens in the
+ * background, as the page it stands in for would, and find() delivers it
+ * through its future. Hashing the contents means reading far more, so
+ * that waits until the visible pages have been rendered. The hashes are
+ * remembered by identity, so store() can still file a preview by its
+ * contents after the file has been renamed.
+ */
+class PreviewCache
+{
+public:
+    PreviewCache();
+
+    QFuture<QImage> find(const QString &path,
+                         const RenderParameters &parameters);
+    void store(const QString &path, const RenderParameters &parameters,
+               const QImage &image);
+
+private:
+    static qint64 diskLimit();
+    static QString identityKey(const QString &path);
+    static QString contentKey(const QString &path);
+    static QString contentKey(const QString &path, const QString &identity);
+    static QString knownContentKey(const QString &identity);
+    static QString parametersKey(const RenderParameters &parameters);
+    static QString hashKey(const QString &key);
+
+    static QImage loadPreview(const QString &fileName);
+    static void writeFile(const QString &fileName, const QByteArray &data);
+    static void evict(const QString &dir, qint64 limit);
+
+    QString dir;
+
+    // Content keys of files we've seen, by identity
+    static QHash<QString, QString> contentKeys;
+    static QMutex contentKeysMutex;
+};
+
+#endif /* PREVIEW_CACHE_H */
@@ -17,13 +17,17 @@
  * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
  */
 
+#include <cstring>  // for std::strcmp()
+
 #include <QCoreApplication>
 #include <QApplication>
+#include <QGuiApplication>
 #include <QCommandLineParser>
 #include <QCommandLineOption>
 
 #include <QDir>
 #include <QFileInfo>
+#include <QStringList>
 
 #ifdef Q_OS_WIN
 #   include <QStyleFactory>
@@ -31,12 +35,24 @@
 
 #include "main_window.h"
 #include "renderer.h"
+#include "render_worker.h"
 
 int main(int argc, char **argv)
 {
     QCoreApplication::setOrganizationName("Benjamin Johnson");
     QCoreApplication::setApplicationName("Renamifier");
 
+    // We may have been started to render files for another copy of us,
+    // which doesn't need a user interface
+    if (argc > 1 && std::strcmp(argv[1], RENDER_WORKER_OPTION) == 0) {
+        // Some renderers need fonts, but we don't need a display
+        qputenv("QT_QPA_PLATFORM", "offscreen");
+        QGuiApplication app(argc, argv);
+        Renderer::init();
+        RenderWorker worker(app.arguments());
+        return worker.exec();
+    }
+
     QApplication app(argc, argv);
     app.setQuitOnLastWindowClosed(true);
 
@@ -19,6 +19,7 @@
 
 #include <QtCore>
 #include <QImageReader>
+#include <QPainter>
 
 #include "render_image.h"
 
@@ -30,24 +31,39 @@ ImageRenderer::ImageRenderer()
 bool ImageRenderer::load()
 {
     QImageReader reader(path());
-    if (reader.read(&image))
+    if (reader.read(&image)) {
+        // We keep this for as long as the file is open, so make it small
+        image = toStorageFormat(image);
         return true;
+    }
     else {
         storeLoadError(reader.errorString());
         return false;
     }
 }
 
-void ImageRenderer::renderPage(int num)
+QImage ImageRenderer::renderPage(const RenderRequest &request)
 {
     if (image.isNull()) {
         emit errorEncountered();
-        return;
+        return QImage();
     }
 
-    if (zoomFactor() == 100)
-        emit renderedPage(num, image);
+    if (!request.region.isNull()) {
+        // Scale only the part of the image that falls within the region
+        QImage tile(request.region.size(),
+                    QImage::Format_ARGB32_Premultiplied);
+        tile.fill(Qt::transparent);
+
+        QPainter painter(&tile);
+        painter.setRenderHint(QPainter::SmoothPixmapTransform);
+        painter.translate(-request.region.topLeft());
+        painter.scale(request.zoomFactor / 100.0, request.zoomFactor / 100.0);
+        painter.drawImage(0, 0, image);
+        return tile;
+    } else if (request.zoomFactor == 100)
+        return image;
     else
-        emit renderedPage(num, image.scaledToWidth(zoomScaled(image.width()),
-                                                   Qt::SmoothTransformation));
+        return image.scaledToWidth(image.width() * request.zoomFactor / 100,
+                                   Qt::SmoothTransformation);
 }
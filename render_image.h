@@ -32,11 +32,13 @@ class ImageRenderer : public PagedContentRenderer {
 public:
     ImageRenderer();
     bool load();
-    void renderPage(int num);
 
     inline int numPages() const { return 1; }
     inline QSize pageSize(int num) const { return zoomScaled(image.size()); }
 
+protected:
+    QImage renderPage(const RenderRequest &request);
+
 private:
     QImage image;
 };
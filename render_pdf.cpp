@@ -17,23 +17,158 @@
  * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
  */
 
-#include <memory>   // for std::unique_ptr
+#include <algorithm>    // for std::min()
+#include <cmath>        // for std::abs()
+#include <cstdlib>      // for std::abs() on integers
+#include <memory>       // for std::unique_ptr
 
 #include <QtCore>
 
 #include <poppler-qt6.h>
 
 #include "render_pdf.h"
+#include "render_scheduler.h"
 #include "renderer_util.h"
 
+// Drafts are rendered at this fraction of the requested resolution
+#define DRAFT_DIVISOR 2
+
+// Embedded thumbnails can be used as drafts if their aspect ratio is within
+// this fraction of the page's. Some are stored unrotated, or padded.
+#define THUMBNAIL_TOLERANCE 0.05
+
+// Number of page sizes to look up at a time in scanPageSizes()
+#define SIZE_SCAN_CHUNK 100
+
+// benchmarkProfiles() renders this many pages at this resolution, and
+// rejects profiles whose pages differ from the first profile's by more
+// than this much on average, out of 255. It only switches profiles for
+// one that takes at least this much less time, in percent.
+#define PROFILE_SAMPLE_PAGES 3
+#define PROFILE_SAMPLE_DPI 72
+#define PROFILE_TOLERANCE 4
+#define PROFILE_MARGIN 20
+
+/*
+ * Ways to render pages. Which is fastest depends a lot on the document:
+ * antialiasing costs little on scans but a lot on detailed drawings, where
+ * it often makes no visible difference at screen resolution, and hinting
+ * can speed up pages of small text. QPainter can be faster for documents
+ * with lots of vector graphics, but can't be interrupted.
+ * The first profile is the default, and the standard the rest are held to.
+ */
+struct RenderProfile {
+    const char *name;           // as stored in the settings
+    const char *description;    // as shown to the user
+    Poppler::Document::RenderBackend backend;
+    Poppler::Document::RenderHints hints;
+    // Whether pages can be abandoned partway through. Only the user can
+    // choose a profile that can't, since it makes scrolling sluggish.
+    bool interruptible;
+};
+
+static const RenderProfile renderProfiles[] = {
+    {"splash", "Splash",
+     Poppler::Document::SplashBackend,
+     Poppler::Document::Antialiasing
+     | Poppler::Document::TextAntialiasing,
+     true},
+    {"splash-thin-lines", "Splash with solid thin lines",
+     Poppler::Document::SplashBackend,
+     Poppler::Document::Antialiasing
+     | Poppler::Document::TextAntialiasing
+     | Poppler::Document::ThinLineSolid,
+     true},
+    {"splash-hinting", "Splash with hinted text",
+     Poppler::Document::SplashBackend,
+     Poppler::Document::Antialiasing
+     | Poppler::Document::TextAntialiasing
+     | Poppler::Document::TextHinting
+     | Poppler::Document::TextSlightHinting,
+     true},
+    {"splash-text-antialiasing", "Splash with only text antialiased",
+     Poppler::Document::SplashBackend,
+     Poppler::Document::TextAntialiasing,
+     true},
+    {"splash-no-antialiasing", "Splash without antialiasing",
+     Poppler::Document::SplashBackend,
+     Poppler::Document::RenderHints(),
+     true},
+    {"qpainter", "QPainter",
+     Poppler::Document::QPainterBackend,
+     Poppler::Document::Antialiasing
+     | Poppler::Document::TextAntialiasing,
+     false},
+};
+static const int renderProfileCount =
+    sizeof(renderProfiles) / sizeof(renderProfiles[0]);
+
+// Every hint a profile or setting might change, so we can reset the rest
+static const Poppler::Document::RenderHint renderHints[] = {
+    Poppler::Document::Antialiasing,
+    Poppler::Document::TextAntialiasing,
+    Poppler::Document::TextHinting,
+    Poppler::Document::TextSlightHinting,
+    Poppler::Document::ThinLineSolid,
+    Poppler::Document::ThinLineShape,
+    Poppler::Document::OverprintPreview,
+    Poppler::Document::HideAnnotations,
+};
+
 struct PDFRendererData {
     std::unique_ptr<Poppler::Document> document;
+    bool loadedFromData;
+    QByteArray bytes;           // if loaded from data
+
+    // Poppler documents can't be used from more than one thread at once,
+    // so each render thread opens its own copy the first time it needs one
+    QHash<QThread*, Poppler::Document*> threadDocuments;
+    QMutex threadDocumentsMutex;
+
+    // Page geometry is looked up once when the document is loaded, since
+    // Poppler has to parse each page to find its size. Until we've scanned
+    // the whole document, we assume every page is the size of the first.
+    int pageCount;
+    QSize firstPageSize;        // in points
+    QList<QSize> pageSizes;     // empty if all pages are the same size
+    QMutex pageSizesMutex;
+
+    // Used by scanPageSizes() to keep track of its progress, which it may
+    // be making on two threads at once if finishPageSizes() is called
+    QList<QSize> scannedSizes;
+    bool scannedUniform;
+    bool scanFinished;
+    QMutex scanMutex;
+
+    // Pages we've found embedded thumbnails for. Documents often have
+    // them for some pages and not others, so we can't go by one page.
+    QSet<int> thumbnailPages;
+    mutable QMutex thumbnailPagesMutex;
+
+    // Index of the profile to render with, which benchmarkProfiles() may
+    // change partway through
+    QAtomicInt profile;
+    bool benchmarkWanted;       // once we've scanned the page sizes
+    // Hints the user wants regardless of the profile
+    Poppler::Document::RenderHints extraHints;
 };
 
-static QString popplerError;
-static QMutex popplerErrorMutex;
+// Poppler reports errors through a callback as they happen, on whichever
+// thread ran into them. Each thread only works on one document at a time,
+// so keeping them per thread is enough to tell whose they are.
+static thread_local QString popplerError;
+
+// Set if Poppler gave up on the page this thread asked it to render
+static thread_local bool renderAborted = false;
 
 static void storePopplerError(const QString &message, const QVariant &closure);
+static void applyProfile(Poppler::Document *document, int index,
+                         Poppler::Document::RenderHints extraHints,
+                         bool draft);
+static bool looksAlike(const QImage &image, const QImage &reference);
+static void runInBackground(PDFRenderer *renderer,
+                            RenderScheduler::Priority priority,
+                            const std::function<void()> &task);
 
 void PDFRenderer::init()
 {
@@ -45,16 +180,22 @@ PDFRenderer::PDFRenderer()
 {
     data = new PDFRendererData;
     data->document = nullptr;
+    data->loadedFromData = false;
+    data->pageCount = 0;
+    data->scannedUniform = true;
+    data->scanFinished = false;
+    data->profile = 0;
+    data->benchmarkWanted = false;
 }
 
 PDFRenderer::~PDFRenderer()
 {
+    qDeleteAll(data->threadDocuments);
     delete data;
 }
 
 bool PDFRenderer::load()
 {
-    QMutexLocker locker(&popplerErrorMutex);
     popplerError.clear();
 
     data->document = Poppler::Document::load(path());
@@ -62,39 +203,150 @@ bool PDFRenderer::load()
         storeLoadError(popplerError);
         popplerError.clear();
         return false;
-    } else
-        return true;
+    }
+
+    initPageSizes();
+    initProfile();
+    scanInBackground();
+    return true;
 }
 
-void PDFRenderer::renderPage(int num)
+QImage PDFRenderer::renderPage(const RenderRequest &request)
 {
-    QMutexLocker locker(&popplerErrorMutex);
     popplerError.clear();
 
-    if (!pageExists(num)) {
+    if (!pageExists(request.page)) {
         emit errorEncountered(popplerError);
         popplerError.clear();
-        return;
+        return QImage();
     }
 
-    // Make the document look nice on screen
-    data->document->setRenderHint(Poppler::Document::Antialiasing);
-    data->document->setRenderHint(Poppler::Document::TextAntialiasing);
+    Poppler::Document *document = threadDocument();
+    if (document == nullptr) {
+        emit errorEncountered(popplerError);
+        popplerError.clear();
+        return QImage();
+    }
 
-    std::unique_ptr<Poppler::Page> page = data->document->page(num);
+    // Make the document look nice on screen, unless we're in a hurry
+    applyProfile(document, data->profile.loadRelaxed(), data->extraHints,
+                 request.draft);
+
+    std::unique_ptr<Poppler::Page> page = document->page(request.page);
     if (page == nullptr) {
         emit errorEncountered(popplerError);
         popplerError.clear();
-        return;
+        return QImage();
+    }
+
+    // Scanners often embed a small image of each page, which is as good
+    // a draft as any and costs nothing to render
+    if (request.draft && request.region.isNull()) {
+        QImage thumbnail = page->thumbnail();
+        QSizeF size = page->pageSizeF();
+        if (!thumbnail.isNull() && !size.isEmpty()
+            && std::abs(thumbnail.width() * size.height()
+                        / (thumbnail.height() * size.width()) - 1.0)
+               < THUMBNAIL_TOLERANCE) {
+            QMutexLocker locker(&data->thumbnailPagesMutex);
+            data->thumbnailPages.insert(request.page);
+            return thumbnail;
+        }
+    }
+
+    int xRes = request.scaledDpiX(), yRes = request.scaledDpiY();
+    QRect region = request.region;
+    if (request.draft) {
+        xRes /= DRAFT_DIVISOR, yRes /= DRAFT_DIVISOR;
+        region = QRect(region.topLeft() / DRAFT_DIVISOR,
+                       region.size() / DRAFT_DIVISOR);
     }
 
-    int xRes = zoomScaled(dpiX()), yRes = zoomScaled(dpiY());
-    QImage image = page->renderToImage(xRes, yRes);
-    if (image.isNull()) {
+    // Poppler can render just part of the page for us
+    if (region.isNull())
+        region = QRect(-1, -1, -1, -1);     // meaning the whole page
+
+    // Poppler checks with us periodically to see if it should stop,
+    // or show the user what it has so far
+    renderAborted = false;
+    QImage image = page->renderToImage(
+        xRes, yRes, region.x(), region.y(), region.width(), region.height(),
+        Poppler::Page::Rotate0,
+        &PDFRenderer::updatePartialRender,
+        &PDFRenderer::shouldUpdatePartialRender,
+        &PDFRenderer::shouldAbortRender, QVariant::fromValue((void*)this));
+
+    // What we have so far is no use if it stopped partway through
+    if (renderAborted)
+        return QImage();
+    else if (image.isNull()) {
         emit errorEncountered(popplerError);
         popplerError.clear();
-    } else
-        emit renderedPage(num, image);
+    }
+    return image;
+}
+
+bool PDFRenderer::hasInstantDraft(int num) const
+{
+    QMutexLocker locker(&data->thumbnailPagesMutex);
+    return data->thumbnailPages.contains(num);
+}
+
+/*
+ * Return this thread's copy of the document, opening it if need be.
+ */
+Poppler::Document *PDFRenderer::threadDocument()
+{
+    // Our own thread can use the copy we loaded. The scheduler never
+    // renders there, and the only other things that use it,
+    // scanPageSizes() and benchmarkProfiles(), take turns with it.
+    QThread *thread = QThread::currentThread();
+    if (thread == this->thread())
+        return data->document.get();
+
+    {
+        QMutexLocker locker(&data->threadDocumentsMutex);
+        Poppler::Document *document = data->threadDocuments.value(thread);
+        if (document != nullptr)
+            return document;
+    }
+
+    // This costs about as much as loading the document did, but each
+    // thread only has to do it once
+    std::unique_ptr<Poppler::Document> document =
+        data->loadedFromData ? Poppler::Document::loadFromData(data->bytes)
+                             : Poppler::Document::load(path());
+    if (document == nullptr)
+        return nullptr;
+
+    QMutexLocker locker(&data->threadDocumentsMutex);
+    data->threadDocuments.insert(thread, document.get());
+    return document.release();
+}
+
+/*
+ * Tell Poppler whether to stop rendering. This is called on the thread
+ * doing the rendering, which keeps track of its own progress.
+ */
+bool PDFRenderer::shouldAbortRender(const QVariant &payload)
+{
+    PDFRenderer *renderer = (PDFRenderer*)payload.value<void*>();
+    if (renderer->shouldAbort())
+        renderAborted = true;
+    return renderAborted;
+}
+
+bool PDFRenderer::shouldUpdatePartialRender(const QVariant &payload)
+{
+    PDFRenderer *renderer = (PDFRenderer*)payload.value<void*>();
+    return renderer->wantsPartialImage();
+}
+
+void PDFRenderer::updatePartialRender(const QImage &image,
+                                      const QVariant &payload)
+{
+    PDFRenderer *renderer = (PDFRenderer*)payload.value<void*>();
+    renderer->partialImage(image);
 }
 
 /*
@@ -105,41 +357,364 @@ void PDFRenderer::renderPage(int num)
 
 int PDFRenderer::numPages() const
 {
-    return (data->document == nullptr) ? 0 : data->document->numPages();
+    return data->pageCount;
 }
 
 QSize PDFRenderer::pageSize(int num) const
 {
     if (pageExists(num)) {
-        std::unique_ptr<Poppler::Page> page = data->document->page(num);
-        if (page != nullptr) {
-            QSize pointSize = page->pageSize();
-            // Convert points to pixels at our current DPI
-            return zoomScaled(QSize(pointSize.width() * dpiX() / 72,
-                                    pointSize.height() * dpiY() / 72));
+        QSize pointSize;
+        {
+            QMutexLocker locker(&data->pageSizesMutex);
+            pointSize = data->pageSizes.isEmpty() ? data->firstPageSize
+                                                  : data->pageSizes[num];
         }
+        // Convert points to pixels at our current DPI
+        return zoomScaled(QSize(pointSize.width() * dpiX() / 72,
+                                pointSize.height() * dpiY() / 72));
     }
     return QSize(0, 0);
 }
 
+/*
+ * Pages are assumed to be the size of the first one until we find out
+ * otherwise.
+ */
+bool PDFRenderer::hasUniformPageSizes() const
+{
+    QMutexLocker locker(&data->pageSizesMutex);
+    return data->pageSizes.isEmpty();
+}
+
+/*
+ * Poppler reads the file on demand when we load it by name.
+ */
+bool PDFRenderer::keepsFileOpen() const
+{
+    return (data->document != nullptr && !data->loadedFromData);
+}
+
 bool PDFRenderer::loadFromData(const QByteArray &bytes)
 {
-    QMutexLocker locker(&popplerErrorMutex);
     popplerError.clear();
 
     data->document = Poppler::Document::loadFromData(bytes);
+    data->loadedFromData = true;
+    data->bytes = bytes;    // for the render threads' copies
     if (data->document == nullptr) {
         storeLoadError(popplerError);
         popplerError.clear();
         return false;
-    } else
-        return true;
+    }
+
+    initPageSizes();
+    initProfile();
+    scanInBackground();
+    return true;
+}
+
+/*
+ * Get just enough page geometry to lay out the document.
+ * scanInBackground() looks up the rest.
+ */
+void PDFRenderer::initPageSizes()
+{
+    data->pageCount = data->document->numPages();
+    if (data->pageCount <= 0) {
+        data->scanFinished = true;
+        return;
+    }
+
+    std::unique_ptr<Poppler::Page> page = data->document->page(0);
+    if (page != nullptr)
+        data->firstPageSize = page->pageSize();
+
+    data->scannedSizes.reserve(data->pageCount);
+}
+
+/*
+ * Scan the page sizes a batch at a time on the render threads, then find
+ * the best profile if initProfile() couldn't. Each batch is a task of its
+ * own, so we don't hold up a thread for long on documents with thousands
+ * of pages, and we give up if the renderer is disposed of in between.
+ */
+void PDFRenderer::scanInBackground()
+{
+    runInBackground(this, RenderScheduler::Prefetch, [this]() {
+        if (shouldAbort())
+            return;
+        else if (!scanPageSizes())
+            scanInBackground();
+        else if (data->benchmarkWanted)
+            runInBackground(this, RenderScheduler::Background,
+                            [this]() { benchmarkProfiles(); });
+    });
+}
+
+/*
+ * Look up the size of the next batch of pages.
+ * Returns true once we have them all.
+ */
+bool PDFRenderer::scanPageSizes()
+{
+    QMutexLocker scanLocker(&data->scanMutex);
+    if (data->scanFinished)
+        return true;    // finishPageSizes() got here first
+
+    int end = std::min(data->scannedSizes.size() + SIZE_SCAN_CHUNK,
+                       (qsizetype)data->pageCount);
+    for (int i = data->scannedSizes.size(); i < end; ++i) {
+        std::unique_ptr<Poppler::Page> page = data->document->page(i);
+        QSize size = (page == nullptr) ? data->firstPageSize
+                                       : page->pageSize();
+        data->scannedSizes.append(size);
+        if (size != data->firstPageSize)
+            data->scannedUniform = false;
+    }
+    popplerError.clear();   // nothing we can do about these here
+
+    if (data->scannedSizes.size() < data->pageCount)
+        return false;
+
+    // If every page is the same size, which is usually the case for
+    // scanned documents, we were right all along and don't need the list
+    if (!data->scannedUniform) {
+        {
+            QMutexLocker locker(&data->pageSizesMutex);
+            data->pageSizes.swap(data->scannedSizes);
+        }
+        emit pageSizesChanged();
+    }
+    data->scannedSizes.clear();
+    data->scannedSizes.squeeze();
+    data->scanFinished = true;
+    return true;
+}
+
+/*
+ * Scan the rest of the page sizes now instead of in the background,
+ * unless whoever wants them gives up first.
+ */
+void PDFRenderer::finishPageSizes()
+{
+    while (!shouldAbort() && !scanPageSizes())
+        ;
+}
+
+QStringList PDFRenderer::profileNames()
+{
+    QStringList names;
+    for (int i = 0; i < renderProfileCount; ++i)
+        names.append(renderProfiles[i].name);
+    return names;
+}
+
+QString PDFRenderer::profileDescription(const QString &name)
+{
+    for (int i = 0; i < renderProfileCount; ++i) {
+        if (name == renderProfiles[i].name)
+            return renderProfiles[i].description;
+    }
+    return QString();
+}
+
+/*
+ * Decide how to render this document. If the user hasn't chosen a profile,
+ * we use whichever was fastest for documents like this one before, or find
+ * out which that is in the background.
+ */
+void PDFRenderer::initProfile()
+{
+    QSettings settings;
+    data->extraHints = Poppler::Document::RenderHints();
+    if (settings.value("pdf/overprint", DEFAULT_PDF_OVERPRINT).toBool())
+        data->extraHints |= Poppler::Document::OverprintPreview;
+    if (settings.value("pdf/hideAnnotations",
+                       DEFAULT_PDF_HIDE_ANNOTATIONS).toBool())
+        data->extraHints |= Poppler::Document::HideAnnotations;
+
+    QString name = settings.value("pdf/profile",
+                                  DEFAULT_PDF_PROFILE).toString();
+    bool chosen = (name != "auto");
+    if (!chosen)
+        name = settings.value(profileKey()).toString();
+
+    // Earlier versions may have picked a profile we no longer would.
+    // Without render threads to benchmark on, as in a render worker
+    // process, we'd hold up the pages we've been asked for, so we leave
+    // that for the next time a document like this is opened in-process.
+    int index = profileNames().indexOf(name);
+    if (index >= 0 && (chosen || renderProfiles[index].interruptible))
+        data->profile = index;
+    else if (data->pageCount > 0 && RenderScheduler::instance() != nullptr)
+        data->benchmarkWanted = true;
+}
+
+/*
+ * Return where we remember the best profile for documents like this one.
+ *
+ * Documents made by the same program, like a particular scanner or word
+ * processor, tend to have a lot in common, so that's what we go by.
+ */
+QString PDFRenderer::profileKey() const
+{
+    static const QRegularExpression versionNumbers("[0-9.]+");
+    QString creator = data->document->info("Creator");
+    QString producer = data->document->info("Producer");
+    QString documentClass = QString("%1\n%2")
+        .arg(creator.remove(versionNumbers).simplified(),
+             producer.remove(versionNumbers).simplified());
+
+    QByteArray hash = QCryptographicHash::hash(documentClass.toUtf8(),
+                                               QCryptographicHash::Sha1);
+    return "pdf/profiles/" + hash.toHex().left(16);
+}
+
+/*
+ * Render a few pages with each profile, and switch to the fastest one
+ * that looks the same as the default and can be interrupted, if it's
+ * clearly faster than the one we're using. Pages rendered before we
+ * decide are rendered again if it changes anything.
+ *
+ * This runs once for each kind of document, as a task on one of the render
+ * threads, using the copy of the document the others don't. If we're
+ * disposed of partway through, we leave the choice for next time.
+ */
+void PDFRenderer::benchmarkProfiles()
+{
+    QList<int> samples;
+    for (int i = 0; i < PROFILE_SAMPLE_PAGES; ++i) {
+        int page = i * (data->pageCount - 1) / (PROFILE_SAMPLE_PAGES - 1);
+        if (!samples.contains(page))
+            samples.append(page);
+    }
+
+    // This also gets fonts and such loaded, so the first profile we time
+    // doesn't pay for that
+    QList<QImage> references;
+    for (int i = 0; i < samples.size(); ++i)
+        references.append(renderSample(0, samples[i]));
+    if (shouldAbort())
+        return;
+
+    // How long each profile took, or -1 if we can't use it
+    QList<qint64> times(renderProfileCount, -1);
+    int best = 0;
+    for (int profile = 0; profile < renderProfileCount; ++profile) {
+        if (!renderProfiles[profile].interruptible)
+            continue;
+
+        QElapsedTimer timer;
+        timer.start();
+
+        bool acceptable = true;
+        for (int i = 0; i < samples.size() && acceptable; ++i)
+            acceptable = looksAlike(renderSample(profile, samples[i]),
+                                    references[i]);
+
+        qint64 time = timer.nsecsElapsed();
+        if (shouldAbort())
+            return;
+        else if (!acceptable)
+            continue;
+
+        times[profile] = time;
+        if (times[best] < 0 || time < times[best])
+            best = profile;
+    }
+
+    // Timings vary from run to run, and with whatever else the render
+    // threads are doing at the time, so a profile that's only a little
+    // faster isn't worth rendering every page on screen again for
+    int current = data->profile.loadRelaxed();
+    if (times[current] >= 0
+        && times[best] * 100 > times[current] * (100 - PROFILE_MARGIN))
+        best = current;
+
+    QSettings settings;
+    settings.setValue(profileKey(), renderProfiles[best].name);
+    if (data->profile.fetchAndStoreRelaxed(best) != best)
+        emit pagesChanged();
+}
+
+QImage PDFRenderer::renderSample(int profile, int num)
+{
+    applyProfile(data->document.get(), profile, data->extraHints, false);
+    std::unique_ptr<Poppler::Page> page = data->document->page(num);
+    QImage image;
+    if (page != nullptr) {
+        renderAborted = false;
+        image = page->renderToImage(
+            PROFILE_SAMPLE_DPI, PROFILE_SAMPLE_DPI, -1, -1, -1, -1,
+            Poppler::Page::Rotate0, nullptr, nullptr,
+            &PDFRenderer::shouldAbortRender,
+            QVariant::fromValue((void*)this));
+    }
+    popplerError.clear();   // the real render will report these
+    return image;
+}
+
+/*
+ * Run part of the work of loading a document in the background: on the
+ * render threads if there are any, or else on our own thread between
+ * requests, as in a render worker process.
+ */
+void runInBackground(PDFRenderer *renderer,
+                     RenderScheduler::Priority priority,
+                     const std::function<void()> &task)
+{
+    RenderScheduler *scheduler = RenderScheduler::instance();
+    if (scheduler != nullptr)
+        scheduler->run(renderer, priority, task);
+    else
+        QMetaObject::invokeMethod(renderer, task, Qt::QueuedConnection);
+}
+
+/*
+ * Set up a document to render with a profile.
+ */
+void applyProfile(Poppler::Document *document, int index,
+                  Poppler::Document::RenderHints extraHints, bool draft)
+{
+    const RenderProfile &profile = renderProfiles[index];
+    Poppler::Document::RenderHints hints = profile.hints | extraHints;
+    if (draft)
+        hints &= ~(Poppler::Document::Antialiasing
+                   | Poppler::Document::TextAntialiasing);
+
+    document->setRenderBackend(profile.backend);
+    for (Poppler::Document::RenderHint hint : renderHints)
+        document->setRenderHint(hint, hints.testFlag(hint));
+}
+
+/*
+ * Return whether an image is close enough to a reference image that
+ * nobody would notice the difference.
+ */
+bool looksAlike(const QImage &image, const QImage &reference)
+{
+    if (image.isNull() || reference.isNull())
+        return false;
+
+    // Backends may round the page size differently
+    QImage a = reference.convertToFormat(QImage::Format_Grayscale8);
+    QImage b = image.convertToFormat(QImage::Format_Grayscale8);
+    if (b.size() != a.size())
+        b = b.scaled(a.size());
+
+    qint64 difference = 0;
+    for (int y = 0; y < a.height(); ++y) {
+        const uchar *lineA = a.constScanLine(y);
+        const uchar *lineB = b.constScanLine(y);
+        for (int x = 0; x < a.width(); ++x)
+            difference += std::abs(lineA[x] - lineB[x]);
+    }
+    return difference <= (qint64)PROFILE_TOLERANCE * a.width() * a.height();
 }
 
 /*
  * Stores debug and error messages from Poppler so we can display them
- * in the application.
- * Note the mutex has already been locked by the time we get here.
+ * in the application. This runs on the thread that ran into them.
  */
 void storePopplerError(const QString &message, const QVariant &closure)
 {
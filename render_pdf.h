@@ -23,11 +23,22 @@
 #include <QObject>
 #include <QSize>
 #include <QByteArray>
+#include <QString>
+#include <QStringList>
+#include <QVariant>
 
 #include "renderer.h"
 
+// Default settings
+#define DEFAULT_PDF_PROFILE "auto"      // or one of profileNames()
+#define DEFAULT_PDF_OVERPRINT false
+#define DEFAULT_PDF_HIDE_ANNOTATIONS false
+
 // Hide backend implementation details
 struct PDFRendererData;
+namespace Poppler {
+class Document;
+}
 
 class PDFRenderer : public PagedContentRenderer {
     Q_OBJECT
@@ -38,15 +49,38 @@ public:
     PDFRenderer();
     ~PDFRenderer();
     virtual bool load();
-    void renderPage(int num);
 
     int numPages() const;
     QSize pageSize(int num) const;
+    bool hasUniformPageSizes() const;
+
+    bool keepsFileOpen() const;
+    inline bool supportsDrafts() const { return true; }
+    bool hasInstantDraft(int num) const;
+    void finishPageSizes();
+
+    // Ways we can render pages, for the settings
+    static QStringList profileNames();
+    static QString profileDescription(const QString &name);
 
 protected:
     bool loadFromData(const QByteArray &bytes);
+    QImage renderPage(const RenderRequest &request);
 
 private:
+    void initPageSizes();
+    void initProfile();
+    void scanInBackground();
+    bool scanPageSizes();
+    void benchmarkProfiles();
+    QString profileKey() const;
+    QImage renderSample(int profile, int num);
+    Poppler::Document *threadDocument();
+    static bool shouldAbortRender(const QVariant &payload);
+    static bool shouldUpdatePartialRender(const QVariant &payload);
+    static void updatePartialRender(const QImage &image,
+                                    const QVariant &payload);
+
     PDFRendererData *data;
 };
 
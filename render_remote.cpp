@@ -0,0 +1,177 @@
+/*
+ * Renderer that runs in a separate worker process.
+ * Copyright (c) 2026 Benjamin Johnson
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <algorithm>    // for std::all_of()
+
+#include <QtCore>
+
+#include "render_remote.h"
+#include "render_scheduler.h"
+#include "render_worker.h"
+
+static void releaseSegment(void *segment);
+
+RemoteRenderer::RemoteRenderer()
+    : PagedContentRenderer()
+{
+    uniformPageSizes = true;
+    drafts = false;
+}
+
+/*
+ * Have the workers let go of the file, since whoever deleted us probably
+ * wants to rename it. We're often deleted on the GUI thread, so we don't
+ * wait for them, but each closes it before starting on anything else.
+ */
+RemoteRenderer::~RemoteRenderer()
+{
+    RenderWorkerPool::instance()->closeFile(path());
+}
+
+bool RemoteRenderer::load()
+{
+    QByteArray request;
+    QDataStream out(&request, QIODevice::WriteOnly);
+    out << (quint8)RenderWorkerPool::Open << path();
+
+    RenderWorkerPool::Reply reply = RenderWorkerPool::instance()->call(
+        path(), request, nullptr, RENDER_WORKER_OPEN_TIMEOUT);
+    if (reply.status != RenderWorkerPool::Succeeded) {
+        storeLoadError(reply.error);
+        return false;
+    }
+
+    QDataStream in(reply.data);
+    in >> pageSizes >> drafts;
+    uniformPageSizes = isUniform(pageSizes);
+
+    // Until we have the rest, we go by what the worker told us so far
+    RenderScheduler *scheduler = RenderScheduler::instance();
+    if (scheduler != nullptr) {
+        scheduler->run(this, RenderScheduler::Prefetch,
+                       [this]() { fetchPageSizes(); });
+    }
+    return true;
+}
+
+/*
+ * Ask the worker for the size of every page, in case it only knew some of
+ * them when we loaded the file. This runs as a task on the scheduler.
+ */
+void RemoteRenderer::fetchPageSizes()
+{
+    QByteArray request;
+    QDataStream out(&request, QIODevice::WriteOnly);
+    out << (quint8)RenderWorkerPool::PageSizes << path();
+
+    RenderWorkerPool::Reply reply = RenderWorkerPool::instance()->call(
+        path(), request, this, RENDER_WORKER_OPEN_TIMEOUT);
+    if (reply.status != RenderWorkerPool::Succeeded)
+        return;     // we'll make do with what we have
+
+    QList<QSize> sizes;
+    QDataStream in(reply.data);
+    in >> sizes;
+    bool uniform = isUniform(sizes);
+    {
+        QMutexLocker locker(&pageSizesMutex);
+        if (sizes.size() != pageSizes.size() || sizes == pageSizes)
+            return;
+        pageSizes.swap(sizes);
+        uniformPageSizes = uniform;
+    }
+    emit pageSizesChanged();
+}
+
+/*
+ * Have a worker render the page. What comes back is in shared memory,
+ * which the image holds on to for as long as it needs it.
+ */
+QImage RemoteRenderer::renderPage(const RenderRequest &request)
+{
+    QByteArray message;
+    QDataStream out(&message, QIODevice::WriteOnly);
+    out << (quint8)RenderWorkerPool::Render << path() << request;
+
+    RenderWorkerPool::Reply reply =
+        RenderWorkerPool::instance()->call(path(), message, this);
+    if (reply.status == RenderWorkerPool::Aborted)
+        return QImage();
+    else if (reply.status != RenderWorkerPool::Succeeded
+             || reply.segment == nullptr) {
+        emit errorEncountered(reply.error);
+        return QImage();
+    }
+
+    QSize size;
+    qint64 bytesPerLine;
+    quint32 format;
+    QList<QRgb> colorTable;
+    QDataStream in(reply.data);
+    in >> size >> bytesPerLine >> format >> colorTable;
+
+    QImage image((const uchar*)reply.segment->constData(),
+                 size.width(), size.height(), bytesPerLine,
+                 (QImage::Format)format, &releaseSegment, reply.segment);
+    if (!colorTable.isEmpty())
+        image.setColorTable(colorTable);
+    return image;
+}
+
+int RemoteRenderer::numPages() const
+{
+    QMutexLocker locker(&pageSizesMutex);
+    return pageSizes.size();
+}
+
+QSize RemoteRenderer::pageSize(int num) const
+{
+    if (pageExists(num)) {
+        // Convert points to pixels at our current DPI
+        QSize pointSize;
+        {
+            QMutexLocker locker(&pageSizesMutex);
+            pointSize = pageSizes[num];
+        }
+        return zoomScaled(QSize(pointSize.width() * dpiX() / 72,
+                                pointSize.height() * dpiY() / 72));
+    }
+    return QSize(0, 0);
+}
+
+bool RemoteRenderer::hasUniformPageSizes() const
+{
+    QMutexLocker locker(&pageSizesMutex);
+    return uniformPageSizes;
+}
+
+bool RemoteRenderer::isUniform(const QList<QSize> &sizes)
+{
+    return std::all_of(sizes.constBegin(), sizes.constEnd(),
+                       [&sizes](const QSize &size)
+                       { return size == sizes.first(); });
+}
+
+/*
+ * Let go of the shared memory holding a page, once the image is deleted.
+ */
+void releaseSegment(void *segment)
+{
+    delete (QSharedMemory*)segment;
+}
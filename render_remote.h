@@ -0,0 +1,67 @@
+/*
+ * Renderer that runs in a separate worker process.
+ * Copyright (c) 2026 Benjamin Johnson
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef RENDER_REMOTE_H
+#define RENDER_REMOTE_H
+
+#include <QObject>
+#include <QList>
+#include <QMutex>
+#include <QSize>
+
+#include "renderer.h"
+
+/*
+ * Stands in for a renderer running in a RenderWorkerPool worker.
+ *
+ * The worker picks the real renderer for the file as usual. Page sizes are
+ * fetched when the file is loaded, as far as the worker knows them by then,
+ * and the rest in the background; everything else is passed along as it's
+ * requested.
+ */
+class RemoteRenderer : public PagedContentRenderer {
+    Q_OBJECT
+
+public:
+    RemoteRenderer();
+    ~RemoteRenderer();
+    bool load();
+
+    int numPages() const;
+    QSize pageSize(int num) const;
+    bool hasUniformPageSizes() const;
+
+    // Or rather, the workers do
+    inline bool keepsFileOpen() const { return true; }
+    inline bool supportsDrafts() const { return drafts; }
+
+protected:
+    QImage renderPage(const RenderRequest &request);
+
+private:
+    void fetchPageSizes();
+    static bool isUniform(const QList<QSize> &sizes);
+
+    QList<QSize> pageSizes;     // in points
+    bool uniformPageSizes;
+    mutable QMutex pageSizesMutex;
+    bool drafts;
+};
+
+#endif /* RENDER_REMOTE_H */
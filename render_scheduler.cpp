@@ -0,0 +1,534 @@
+/*
+ * Decides which page to render next.
+ * Copyright (c) 2026 Benjamin Johnson
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <algorithm>    // for std::min() and std::max()
+
+#include <QtCore>
+
+#include "render_scheduler.h"
+
+RenderScheduler *RenderScheduler::instance_ = nullptr;
+
+/*
+ * Start a pool of render threads. If threadCount isn't positive, we use
+ * defaultThreadCount().
+ */
+RenderScheduler::RenderScheduler(int threadCount, QObject *parent)
+    : QObject(parent)
+{
+    if (instance_ == nullptr)
+        instance_ = this;
+
+    if (threadCount <= 0)
+        threadCount = defaultThreadCount();
+
+    QSettings settings;
+    helperLimit = std::max(settings.value("render/helpers",
+                                          DEFAULT_RENDER_HELPERS).toInt(), 1);
+
+    for (int i = 0; i < threadCount; ++i) {
+        Worker *worker = new Worker;
+        worker->isBusy = false;
+        worker->thread = new QThread(this);
+        worker->context = new QObject;
+        worker->context->moveToThread(worker->thread);
+        connect(worker->thread, &QThread::finished,
+                worker->context, &QObject::deleteLater);
+        worker->thread->start();
+        workers.append(worker);
+    }
+}
+
+/*
+ * Stop all rendering and shut down the render threads.
+ * Renderers waiting to be disposed of are deleted on their own threads,
+ * so make sure those are still running.
+ */
+RenderScheduler::~RenderScheduler()
+{
+    {
+        QMutexLocker locker(&jobsMutex);
+        jobs.clear();
+        for (int i = 0; i < workers.size(); ++i)
+            workers[i]->progress.aborted.storeRelaxed(1);
+    }
+
+    for (int i = 0; i < workers.size(); ++i) {
+        workers[i]->thread->quit();
+        workers[i]->thread->wait();
+    }
+
+    QSet<PagedContentRenderer*>::const_iterator i;
+    for (i = disposed.constBegin(); i != disposed.constEnd(); ++i)
+        (*i)->deleteLater();
+    qDeleteAll(workers);
+
+    if (instance_ == this)
+        instance_ = nullptr;
+}
+
+/*
+ * Return the number of render threads to use, from the settings.
+ */
+int RenderScheduler::defaultThreadCount()
+{
+    QSettings settings;
+    int count = settings.value("render/threads",
+                               DEFAULT_RENDER_THREADS).toInt();
+    if (count <= 0)
+        count = std::min(QThread::idealThreadCount(), MAX_RENDER_THREADS);
+    return std::max(count, 1);
+}
+
+/*
+ * Replace the pending requests for this renderer at this priority.
+ * Pass an empty list to withdraw them.
+ */
+void RenderScheduler::submit(PagedContentRenderer *renderer,
+                             Priority priority,
+                             const QList<RenderRequest> &requests)
+{
+    // Make sure we never touch this renderer after it's gone.
+    // This has to be a direct connection so it happens before then.
+    connect(renderer, &QObject::destroyed,
+            this, &RenderScheduler::rendererDestroyed,
+            Qt::ConnectionType(Qt::DirectConnection | Qt::UniqueConnection));
+
+    QMutexLocker locker(&jobsMutex);
+
+    // Anything requested with a future stays until that's cancelled,
+    // and the renderer's own tasks aren't ours to replace
+    jobs.removeIf([renderer, priority](const Job &job) {
+        return (job.renderer == renderer && job.priority == priority
+                && job.promise == nullptr && !job.task);
+    });
+
+    bool isUrgent = false;
+    for (int i = 0; i < requests.size(); ++i) {
+        const RenderRequest &request = requests[i];
+
+        bool duplicate = false;
+        for (int j = 0; j < workers.size() && !duplicate; ++j) {
+            // This is already on its way, unless we stopped it
+            const Worker *worker = workers[j];
+            duplicate = (worker->isBusy
+                         && worker->job.renderer == renderer
+                         && worker->job.request == request
+                         && worker->job.promise == nullptr
+                         && !worker->job.task
+                         && !worker->progress.aborted.loadRelaxed());
+        }
+        for (int j = 0; j < jobs.size() && !duplicate; ++j) {
+            const Job &job = jobs[j];
+            duplicate = (job.renderer == renderer
+                         && job.priority == priority
+                         && job.request == request
+                         && job.promise == nullptr && !job.task);
+        }
+        if (!duplicate) {
+            jobs.append(Job{renderer, priority, request,
+                            nullptr, {}, nullptr, false});
+            isUrgent = true;
+        }
+    }
+
+    // Stop work on anything we've been told we don't need anymore
+    for (int i = 0; i < workers.size(); ++i) {
+        Worker *worker = workers[i];
+        const Job &job = worker->job;
+        if (worker->isBusy && job.renderer == renderer
+            && job.priority == priority && job.promise == nullptr
+            && !job.task && !requests.contains(job.request))
+            worker->progress.aborted.storeRelaxed(1);
+    }
+
+    if (isUrgent)
+        preemptFor(priority);
+    schedule();
+}
+
+/*
+ * Render a page and hand it back through a future, instead of the
+ * renderer's renderedPage signal. The page is abandoned if the future is
+ * cancelled, or if the renderer's pages are cancel()ed or it's disposed of.
+ * The future is cancelled then too, with no result, so check isCanceled()
+ * or resultCount() before asking for result().
+ */
+QFuture<RenderResult> RenderScheduler::request(
+    PagedContentRenderer *renderer, Priority priority,
+    const RenderRequest &request)
+{
+    connect(renderer, &QObject::destroyed,
+            this, &RenderScheduler::rendererDestroyed,
+            Qt::ConnectionType(Qt::DirectConnection | Qt::UniqueConnection));
+
+    std::shared_ptr<QPromise<RenderResult>> promise =
+        std::make_shared<QPromise<RenderResult>>();
+    promise->start();
+
+    QMutexLocker locker(&jobsMutex);
+    jobs.append(Job{renderer, priority, request,
+                    nullptr, {}, promise, false});
+    preemptFor(priority);
+    schedule();
+    return promise->future();
+}
+
+/*
+ * Have a text renderer render its file, and hand the text back through a
+ * future.
+ *
+ * Text renderers aren't safe to use from more than one thread, so this
+ * happens on the renderer's own thread, after whatever events it already
+ * has queued, and not on ours. It's cancelled if the renderer is deleted
+ * first. Cancelling the future before then means the file isn't read.
+ */
+QFuture<RenderResult> RenderScheduler::request(TextContentRenderer *renderer)
+{
+    std::shared_ptr<QPromise<RenderResult>> promise =
+        std::make_shared<QPromise<RenderResult>>();
+    promise->start();
+
+    QMetaObject::invokeMethod(renderer, [renderer, promise]() {
+        RenderResult result;
+        if (!promise->isCanceled()) {
+            // The renderer answers with signals, which arrive right here
+            // since we're on its thread
+            QMetaObject::Connection textConnection = connect(
+                renderer, &TextContentRenderer::renderedText,
+                [&result](const QString &text) { result.text = text; });
+            QMetaObject::Connection errorConnection = connect(
+                renderer, &Renderer::errorEncountered,
+                [&result](const QString &details) { result.error = details; });
+
+            renderer->render();
+            disconnect(textConnection);
+            disconnect(errorConnection);
+        }
+        promise->addResult(result);
+        promise->finish();
+    }, Qt::QueuedConnection);
+    return promise->future();
+}
+
+/*
+ * Run a task on one of our threads. Tasks can't be interrupted once
+ * they've started, but pending ones can be withdrawn with cancelTasks().
+ *
+ * Set usesHelper if the task runs a helper program, so it waits its turn
+ * for one of the few the settings allow at once (see Renderer::runHelper()).
+ */
+void RenderScheduler::run(Priority priority, const QObject *owner,
+                          const std::function<void()> &task, bool usesHelper)
+{
+    QMutexLocker locker(&jobsMutex);
+    jobs.append(Job{nullptr, priority, RenderRequest(),
+                    owner, task, nullptr, usesHelper});
+    preemptFor(priority);
+    schedule();
+}
+
+/*
+ * Run a task for a renderer on one of our threads. The renderer can call
+ * shouldAbort() from the task to find out if it's been disposed of or
+ * finish()ed in the meantime.
+ */
+void RenderScheduler::run(PagedContentRenderer *renderer, Priority priority,
+                          const std::function<void()> &task)
+{
+    connect(renderer, &QObject::destroyed,
+            this, &RenderScheduler::rendererDestroyed,
+            Qt::ConnectionType(Qt::DirectConnection | Qt::UniqueConnection));
+
+    QMutexLocker locker(&jobsMutex);
+    if (disposed.contains(renderer))
+        return;     // it's on its way out
+    jobs.append(Job{renderer, priority, RenderRequest(),
+                    renderer, task, nullptr, false});
+    preemptFor(priority);
+    schedule();
+}
+
+/*
+ * Withdraw all pending tasks for this owner.
+ */
+void RenderScheduler::cancelTasks(const QObject *owner)
+{
+    QMutexLocker locker(&jobsMutex);
+    jobs.removeIf([owner](const Job &job) {
+        return job.renderer == nullptr && job.owner == owner;
+    });
+}
+
+/*
+ * Withdraw all pending tasks for this owner, and wait until none of
+ * its tasks are running.
+ */
+void RenderScheduler::finishTasks(const QObject *owner)
+{
+    QMutexLocker locker(&jobsMutex);
+    for (;;) {
+        // A task may have queued another on its way out
+        jobs.removeIf([owner](const Job &job) {
+            return job.renderer == nullptr && job.owner == owner;
+        });
+
+        bool isRunning = false;
+        for (int i = 0; i < workers.size() && !isRunning; ++i) {
+            const Worker *worker = workers[i];
+            isRunning = (worker->isBusy && worker->job.renderer == nullptr
+                         && worker->job.owner == owner);
+        }
+        if (!isRunning)
+            break;
+        jobFinished.wait(&jobsMutex);
+    }
+}
+
+/*
+ * Withdraw all pending requests for this renderer, and stop any pages
+ * in progress as soon as we can. Its own tasks carry on, since it's
+ * still in use.
+ */
+void RenderScheduler::cancel(PagedContentRenderer *renderer)
+{
+    QMutexLocker locker(&jobsMutex);
+    cancelJobs(renderer, false);
+}
+
+/*
+ * Cancel everything for this renderer, then delete it once none of our
+ * threads are using it. This returns right away.
+ */
+void RenderScheduler::dispose(PagedContentRenderer *renderer)
+{
+    QMutexLocker locker(&jobsMutex);
+    cancelJobs(renderer, true);
+
+    if (isRendering(renderer))
+        disposed.insert(renderer);  // runJob() will take care of it
+    else
+        renderer->deleteLater();
+}
+
+/*
+ * Cancel everything for this renderer, and wait until none of our
+ * threads are using it.
+ */
+void RenderScheduler::finish(PagedContentRenderer *renderer)
+{
+    QMutexLocker locker(&jobsMutex);
+    cancelJobs(renderer, true);
+
+    while (isRendering(renderer)) {
+        jobFinished.wait(&jobsMutex);
+        // A task may have queued another on its way out
+        cancelJobs(renderer, true);
+    }
+}
+
+void RenderScheduler::cancelJobs(PagedContentRenderer *renderer,
+                                 bool includeTasks)
+{
+    jobs.removeIf([renderer, includeTasks](const Job &job) {
+        return (job.renderer == renderer && (includeTasks || !job.task));
+    });
+
+    for (int i = 0; i < workers.size(); ++i) {
+        Worker *worker = workers[i];
+        if (worker->isBusy && worker->job.renderer == renderer
+            && (includeTasks || !worker->job.task))
+            worker->progress.aborted.storeRelaxed(1);
+    }
+}
+
+bool RenderScheduler::isRendering(const PagedContentRenderer *renderer) const
+{
+    for (int i = 0; i < workers.size(); ++i) {
+        if (workers[i]->isBusy && workers[i]->job.renderer == renderer)
+            return true;
+    }
+    return false;
+}
+
+/*
+ * Make room for new work at this priority if every thread is busy, by
+ * interrupting the least urgent page in progress once it's had its
+ * time slice.
+ */
+void RenderScheduler::preemptFor(Priority priority)
+{
+    Worker *leastUrgent = nullptr;
+    for (int i = 0; i < workers.size(); ++i) {
+        Worker *worker = workers[i];
+        if (!worker->isBusy)
+            return;     // it'll get to this soon enough
+
+        // Only pages can be interrupted
+        const Job &job = worker->job;
+        if (job.renderer != nullptr && !job.task && job.priority > priority
+            && (leastUrgent == nullptr
+                || job.priority > leastUrgent->job.priority))
+            leastUrgent = worker;
+    }
+
+    if (leastUrgent != nullptr)
+        leastUrgent->progress.preempted.storeRelaxed(1);
+}
+
+/*
+ * Return the index of the job to run next, or -1 if there is none we
+ * can start right now.
+ */
+int RenderScheduler::nextJob() const
+{
+    int lowPriorityBusy = 0, helpersBusy = 0;
+    for (int i = 0; i < workers.size(); ++i) {
+        const Worker *worker = workers[i];
+        if (worker->isBusy && worker->job.priority >= Prefetch)
+            ++lowPriorityBusy;
+        if (worker->isBusy && worker->job.usesHelper)
+            ++helpersBusy;
+    }
+    bool lowPriorityAllowed = (lowPriorityBusy
+        < std::max(1, (int)workers.size() - RESERVED_RENDER_THREADS));
+    bool helperAllowed = (helpersBusy < helperLimit);
+
+    int next = -1;
+    for (int i = 0; i < jobs.size(); ++i) {
+        const Job &job = jobs[i];
+        if ((job.priority >= Prefetch && !lowPriorityAllowed)
+            || (job.usesHelper && !helperAllowed))
+            continue;   // these can wait
+
+        if (next < 0 || job.priority < jobs[next].priority)
+            next = i;
+        if (jobs[next].priority == Visible)
+            break;  // nothing beats this
+    }
+    return next;
+}
+
+/*
+ * Hand out jobs to any threads that are free.
+ */
+void RenderScheduler::schedule()
+{
+    for (int i = 0; i < workers.size(); ++i) {
+        Worker *worker = workers[i];
+        if (worker->isBusy)
+            continue;
+
+        int next = nextJob();
+        if (next < 0)
+            break;  // nothing left to do
+
+        worker->job = jobs.takeAt(next);
+        worker->isBusy = true;
+        worker->progress.aborted.storeRelaxed(0);
+        worker->progress.preempted.storeRelaxed(0);
+        worker->progress.promise = worker->job.promise.get();
+
+        // We go back to the event loop between pages, rather than rendering
+        // everything in one go, so the thread can be shut down in between
+        QMetaObject::invokeMethod(worker->context,
+                                  [this, worker]() { runJob(worker); },
+                                  Qt::QueuedConnection);
+    }
+}
+
+/*
+ * Render the page or run the task assigned to a thread.
+ * This runs on that thread.
+ */
+void RenderScheduler::runJob(Worker *worker)
+{
+    // The renderer won't be deleted while the worker is busy with it
+    // (see dispose()), so this is still valid even if it was cancelled
+    const Job &job = worker->job;
+    bool finished = false;
+    if (job.renderer == nullptr) {
+        job.task();
+        finished = true;
+    } else if (job.task) {
+        if (!worker->progress.aborted.loadRelaxed())
+            job.renderer->runTask(job.task, &worker->progress);
+        finished = true;
+    } else if (job.promise != nullptr)
+        finished = fulfil(job, &worker->progress);
+    else if (!worker->progress.aborted.loadRelaxed())
+        finished = job.renderer->render(job.request, &worker->progress);
+
+    QMutexLocker locker(&jobsMutex);
+
+    // Pick up where we left off once the more urgent work is done
+    if (!finished && worker->progress.preempted.loadRelaxed()
+        && !worker->progress.aborted.loadRelaxed())
+        jobs.prepend(job);
+
+    worker->isBusy = false;
+    // Let go of anything the job captured. A promise nobody fulfilled
+    // cancels its future as it goes.
+    worker->job.task = nullptr;
+    worker->job.promise.reset();
+    worker->progress.promise = nullptr;
+    if (job.renderer != nullptr && disposed.contains(job.renderer)
+        && !isRendering(job.renderer)) {
+        disposed.remove(job.renderer);
+        job.renderer->deleteLater();
+    }
+
+    jobFinished.wakeAll();
+    schedule();
+}
+
+/*
+ * Render a page someone's waiting for, and pass it to them through the
+ * job's promise. Returns false if it was preempted and needs another go.
+ */
+bool RenderScheduler::fulfil(const Job &job, RenderProgress *progress)
+{
+    QPromise<RenderResult> *promise = job.promise.get();
+    QImage image;
+    if (!promise->isCanceled() && !progress->aborted.loadRelaxed())
+        image = job.renderer->renderImage(job.request, progress);
+
+    // Dropping an abandoned page's promise cancels its future (see runJob())
+    if (progress->aborted.loadRelaxed() || promise->isCanceled())
+        return true;
+    else if (image.isNull() && progress->preempted.loadRelaxed())
+        return false;
+
+    promise->addResult(RenderResult{job.request, image, QString(),
+                                    progress->error});
+    promise->finish();
+    return true;
+}
+
+/*
+ * Forget about a renderer that is being deleted.
+ */
+void RenderScheduler::rendererDestroyed(QObject *renderer)
+{
+    // By now this is only a QObject, so we can compare but not cast it
+    QMutexLocker locker(&jobsMutex);
+    jobs.removeIf([renderer](const Job &job) {
+        return (QObject*)job.renderer == renderer;
+    });
+}
@@ -0,0 +1,186 @@
+/*
+ * Decides which page to render next.
+ * Copyright (c) 2026 Benjamin Johnson
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef RENDER_SCHEDULER_H
+#define RENDER_SCHEDULER_H
+
+#include <functional>     // for std::function
+#include <memory>           // for std::shared_ptr
+
+#include <QObject>
+#include <QFuture>
+#include <QList>
+#include <QMutex>
+#include <QSet>
+#include <QThread>
+#include <QWaitCondition>
+
+#include "renderer.h"
+
+// Default settings
+#define DEFAULT_RENDER_THREADS 0    // one per processor core
+#define MAX_RENDER_THREADS 8        // when choosing automatically
+#define DEFAULT_RENDER_HELPERS 2    // helper programs to run at once
+
+// Threads Prefetch and Background work can't have, so there's always one
+// free for pages the user is waiting for
+#define RESERVED_RENDER_THREADS 1
+
+/*
+ * Shares a pool of threads between all the background work in the
+ * program, most of which is rendering pages.
+ *
+ * There's normally just one of these, created by the Viewer, which
+ * instance() returns.
+ *
+ * Call submit() with a renderer, a priority, and a list of the pages you
+ * want in the order you want them. Pages come back through the renderer's
+ * renderedPage signal as usual, but may be emitted from any of the
+ * scheduler's threads, and may arrive out of order.
+ *
+ * Each submit() replaces whatever was submitted before for the same
+ * renderer at the same priority and hasn't started yet, so pages nobody
+ * wants anymore are simply left out of the next call. Requests identical
+ * to one in progress are ignored.
+ *
+ * Each thread renders one page at a time, going back to the event loop in
+ * between, and the highest-priority request always goes to the next free
+ * thread. Requests of the same priority are started in the order
+ * submitted. Several pages of the same renderer may be rendered at once,
+ * so renderers must be able to handle that (see PagedContentRenderer).
+ *
+ * Renderers that check shouldAbort() can also be stopped partway through
+ * a page. This happens when the page is left out of the next submit() at
+ * its priority, or its renderer is cancel()ed, in which case it's dropped.
+ * It also happens when more urgent work arrives while every thread is
+ * busy and the page has had its time slice, in which case it's put back
+ * at the front of its queue.
+ *
+ * Since renderers may be in use on any of our threads, delete them with
+ * dispose(), which waits until we're done with them. If you need one
+ * gone right away, call finish() first, which blocks until it's free.
+ *
+ * Callers that want a particular page back, rather than watching for it
+ * among everything the renderer sends, can request() it instead. This
+ * returns a future with the page and any error the renderer reported
+ * while rendering that page, and cancelling the future stops work on it.
+ * A page that's abandoned for any reason leaves its future cancelled with
+ * no result, so check isCanceled() or resultCount() before result().
+ * Text renderers can be request()ed the same way, though their text is
+ * read on the renderer's own thread rather than ours.
+ *
+ * Other work, like loading files, is passed to run() as a task with a
+ * priority and an owner to cancel it by. Tasks wait their turn along with
+ * pages of the same priority, but can't be interrupted once started.
+ * Tasks that run a helper program, which is a process of its own and
+ * usually a busy one, should say so, and only a few of those are started
+ * at once; the rest wait in the queue without holding up a thread.
+ * Renderers can also run() work of their own, like looking up page sizes,
+ * which cancel() leaves alone but dispose() and finish() don't. These
+ * tasks can check shouldAbort() to give up early when that happens.
+ *
+ * Prefetch and Background work never takes up every thread, so there's
+ * always one ready for the pages the user is looking at.
+ */
+class RenderScheduler : public QObject
+{
+    Q_OBJECT
+
+public:
+    // Most urgent first
+    enum Priority {
+        Visible,        // pages the user is looking at
+        Adjacent,       // pages about to scroll into view
+        Prefetch,       // pages of files the user will probably view next
+        Background      // everything else, like the rest of a document
+    };
+
+    RenderScheduler(int threadCount = 0, QObject *parent = nullptr);
+    ~RenderScheduler();
+
+    static inline RenderScheduler *instance() { return instance_; }
+    inline int threadCount() const { return workers.size(); }
+    static int defaultThreadCount();
+
+    // These are safe to call from any thread
+    void submit(PagedContentRenderer *renderer, Priority priority,
+                const QList<RenderRequest> &requests);
+    void cancel(PagedContentRenderer *renderer);
+    void dispose(PagedContentRenderer *renderer);
+    void finish(PagedContentRenderer *renderer);
+
+    QFuture<RenderResult> request(PagedContentRenderer *renderer,
+                                  Priority priority,
+                                  const RenderRequest &request);
+    QFuture<RenderResult> request(TextContentRenderer *renderer);
+
+    void run(Priority priority, const QObject *owner,
+             const std::function<void()> &task, bool usesHelper = false);
+    void run(PagedContentRenderer *renderer, Priority priority,
+             const std::function<void()> &task);
+    void cancelTasks(const QObject *owner);
+    void finishTasks(const QObject *owner);
+
+private:
+    // A page to render, a task for a renderer if there's both,
+    // or a task of its own if there's no renderer
+    struct Job {
+        PagedContentRenderer *renderer;
+        Priority priority;
+        RenderRequest request;
+        const QObject *owner;
+        std::function<void()> task;
+        // If someone's waiting for this page in particular
+        std::shared_ptr<QPromise<RenderResult>> promise;
+        bool usesHelper;    // if it's a task that runs a helper program
+    };
+
+    struct Worker {
+        QThread *thread;
+        QObject *context;   // lives on the thread, to run jobs there
+        bool isBusy;
+        Job job;            // if busy
+        RenderProgress progress;
+    };
+
+    // Note the mutex must already be locked for these
+    void cancelJobs(PagedContentRenderer *renderer, bool includeTasks);
+    bool isRendering(const PagedContentRenderer *renderer) const;
+    int nextJob() const;
+    void preemptFor(Priority priority);
+    void schedule();
+
+    void runJob(Worker *worker);
+    bool fulfil(const Job &job, RenderProgress *progress);
+
+    QList<Job> jobs;
+    QList<Worker*> workers;
+    // Renderers to delete once we've finished with them
+    QSet<PagedContentRenderer*> disposed;
+    QMutex jobsMutex;
+    QWaitCondition jobFinished;
+    int helperLimit;
+
+    static RenderScheduler *instance_;
+
+private slots:
+    void rendererDestroyed(QObject *renderer);
+};
+
+#endif /* RENDER_SCHEDULER_H */
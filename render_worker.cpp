@@ -0,0 +1,809 @@
+/*
+ * Rendering in separate worker processes.
+ * Copyright (c) 2026 Benjamin Johnson
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <cstring>      // for std::memcpy()
+
+#include <QtCore>
+
+#ifdef Q_OS_WIN
+#   include <fcntl.h>
+#   include <io.h>
+#else
+#   include <sys/resource.h>
+#   include <unistd.h>
+#endif
+
+#include "render_worker.h"
+#include "render_scheduler.h"
+
+// How often to check whether a request should be abandoned, in ms
+#define RENDER_WORKER_POLL_INTERVAL 20
+
+// Number of files each worker keeps open
+#define RENDER_WORKER_FILES 4
+
+// Each message is preceded by its size and the ID of the request
+#define HEADER_SIZE 8
+
+RenderWorkerPool *RenderWorkerPool::instance_ = nullptr;
+QThread *RenderWorkerPool::thread_ = nullptr;
+static QMutex instanceMutex;
+
+// Set in worker processes, which render everything themselves
+static bool isWorkerProcess = false;
+
+static QByteArray frame(quint32 id, const QByteArray &data);
+
+/*
+ * Return whether the user wants files rendered in worker processes.
+ */
+bool RenderWorkerPool::isEnabled()
+{
+    if (isWorkerProcess)
+        return false;
+
+    QSettings settings;
+    return settings.value("render/isolated",
+                          DEFAULT_ISOLATED_RENDERING).toBool();
+}
+
+/*
+ * Return the pool, starting it if need be. Its workers are started as
+ * they're needed.
+ */
+RenderWorkerPool *RenderWorkerPool::instance()
+{
+    QMutexLocker locker(&instanceMutex);
+    if (instance_ == nullptr) {
+        // Talking to the workers happens on a thread of our own, so it
+        // doesn't depend on whoever is waiting for them
+        thread_ = new QThread;
+        instance_ = new RenderWorkerPool;
+        instance_->moveToThread(thread_);
+        QObject::connect(thread_, &QThread::finished,
+                         instance_, &QObject::deleteLater);
+        thread_->start();
+
+        // Renderers are deleted along with the main window, which may
+        // still need us, so wait until the very end to shut down
+        qAddPostRoutine(&RenderWorkerPool::shutdown);
+    }
+    return instance_;
+}
+
+RenderWorkerPool::RenderWorkerPool()
+    : QObject()
+{
+    // One for each render thread, plus one for loading files
+    maxWorkers = RenderScheduler::defaultThreadCount() + 1;
+    lastRequestId = 0;
+}
+
+/*
+ * Stop all the workers. This runs on the pool's thread.
+ */
+RenderWorkerPool::~RenderWorkerPool()
+{
+    for (int i = 0; i < workers.size(); ++i) {
+        QProcess *process = workers[i]->process;
+        if (process != nullptr) {
+            disconnect(process, nullptr, this, nullptr);
+            // Workers exit when they run out of input
+            process->closeWriteChannel();
+            if (!process->waitForFinished(1000))
+                process->kill();
+            delete process;
+        }
+    }
+    qDeleteAll(workers);
+}
+
+void RenderWorkerPool::shutdown()
+{
+    QMutexLocker locker(&instanceMutex);
+    if (thread_ != nullptr) {
+        thread_->quit();
+        thread_->wait();
+        delete thread_;
+        thread_ = nullptr;
+        instance_ = nullptr;
+    }
+}
+
+/*
+ * Send a request to a worker, preferably one that already has the file
+ * open, and wait for the reply.
+ */
+RenderWorkerPool::Reply RenderWorkerPool::call(
+    const QString &path, const QByteArray &request,
+    const PagedContentRenderer *renderer, int timeout)
+{
+    QMutexLocker locker(&mutex);
+    Worker *worker = acquire(path);
+    Reply reply = callWorker(worker, request, renderer, timeout);
+    if (reply.status != Failed)
+        worker->paths.insert(path);
+    release(worker);
+    return reply;
+}
+
+/*
+ * Have every worker close this file, without waiting for them to do it.
+ * Workers that are busy close it as soon as they're done, since anything
+ * we sent them now would be mistaken for taking their reply.
+ */
+void RenderWorkerPool::closeFile(const QString &path)
+{
+    QMutexLocker locker(&mutex);
+    for (int i = 0; i < workers.size(); ++i) {
+        Worker *worker = workers[i];
+        if (!worker->paths.contains(path))
+            continue;
+        else if (worker->isBusy)
+            worker->closing.insert(path);
+        else {
+            worker->paths.remove(path);
+            sendClose(worker, path);
+        }
+    }
+}
+
+/*
+ * Find a worker for a file, waiting for one to be free if there are
+ * already as many as we allow.
+ * Note the mutex must already be locked.
+ */
+RenderWorkerPool::Worker *RenderWorkerPool::acquire(const QString &path)
+{
+    for (;;) {
+        Worker *idle = nullptr;
+        for (int i = 0; i < workers.size(); ++i) {
+            Worker *worker = workers[i];
+            if (worker->isBusy)
+                continue;
+            else if (worker->paths.contains(path)) {
+                idle = worker;
+                break;
+            } else if (idle == nullptr)
+                idle = worker;
+        }
+
+        if (idle == nullptr && workers.size() < maxWorkers) {
+            // The process itself is started by send()
+            idle = new Worker;
+            idle->process = nullptr;
+            idle->processId = 0;
+            idle->requestId = 0;
+            idle->hasReply = false;
+            workers.append(idle);
+        }
+
+        if (idle != nullptr) {
+            idle->isBusy = true;
+            return idle;
+        }
+        workerFreed.wait(&mutex);
+    }
+}
+
+void RenderWorkerPool::release(Worker *worker)
+{
+    // Now that we have its reply, it can close anything it was asked to
+    for (const QString &path : worker->closing) {
+        worker->paths.remove(path);
+        sendClose(worker, path);
+    }
+    worker->closing.clear();
+
+    worker->isBusy = false;
+    workerFreed.wakeAll();
+}
+
+/*
+ * Tell a worker to close a file, ignoring its reply.
+ * Note the mutex must already be locked.
+ */
+void RenderWorkerPool::sendClose(Worker *worker, const QString &path)
+{
+    QByteArray request;
+    QDataStream out(&request, QIODevice::WriteOnly);
+    out << (quint8)Close << path;
+
+    // Anything sent to it after this is queued behind it
+    quint32 id = ++lastRequestId;
+    QMetaObject::invokeMethod(this,
+                              [this, worker, id, request]() {
+                                  send(worker, id, request);
+                              }, Qt::QueuedConnection);
+}
+
+/*
+ * Send a request to a worker we've acquired, and wait for the reply.
+ * Note the mutex must already be locked.
+ */
+RenderWorkerPool::Reply RenderWorkerPool::callWorker(
+    Worker *worker, const QByteArray &request,
+    const PagedContentRenderer *renderer, int timeout)
+{
+    quint32 id = ++lastRequestId;
+    worker->requestId = id;
+    worker->hasReply = false;
+    worker->reply.clear();
+    worker->error.clear();
+    QMetaObject::invokeMethod(this,
+                              [this, worker, id, request]() {
+                                  send(worker, id, request);
+                              }, Qt::QueuedConnection);
+
+    QDeadlineTimer deadline(timeout);
+    bool aborted = false;
+    while (!worker->hasReply) {
+        if (deadline.hasExpired()) {
+            // There's no telling what it's doing, so start over with a new
+            // one. This is queued ahead of anything else sent to it.
+            QMetaObject::invokeMethod(this,
+                                      [this, worker, id]() {
+                                          restart(worker, id);
+                                      }, Qt::QueuedConnection);
+            worker->error = "The renderer stopped responding.";
+            break;
+        }
+
+        replied.wait(&mutex, RENDER_WORKER_POLL_INTERVAL);
+        if (!aborted && renderer != nullptr && renderer->shouldAbort()) {
+            // It'll tell us once it's stopped
+            QMetaObject::invokeMethod(this,
+                                      [this, worker, id]() {
+                                          sendAbort(worker, id);
+                                      }, Qt::QueuedConnection);
+            aborted = true;
+        }
+    }
+
+    Reply reply;
+    reply.segment = nullptr;
+    if (worker->reply.isEmpty()) {
+        reply.status = Failed;
+        reply.error = worker->error;
+        return reply;
+    }
+
+    QDataStream in(worker->reply);
+    quint8 status;
+    QString segmentKey;
+    in >> status >> reply.error >> segmentKey;
+    reply.status = (Status)status;
+    reply.data = worker->reply.mid(in.device()->pos());
+
+    // The worker lets go of this as soon as we send it anything else,
+    // so we have to get hold of it before anyone else can
+    if (!segmentKey.isEmpty()) {
+        reply.segment = new QSharedMemory;
+        reply.segment->setKey(segmentKey);
+        if (!reply.segment->attach(QSharedMemory::ReadOnly)) {
+            reply.status = Failed;
+            reply.error = reply.segment->errorString();
+            delete reply.segment;
+            reply.segment = nullptr;
+        }
+    }
+    return reply;
+}
+
+/*
+ * Send a request to a worker, starting it first if need be.
+ */
+void RenderWorkerPool::send(Worker *worker, quint32 id,
+                            const QByteArray &request)
+{
+    if (worker->process == nullptr) {
+        QSettings settings;
+        int memoryLimit = settings.value("render/workerMemory",
+                                         DEFAULT_RENDER_WORKER_MEMORY).toInt();
+
+        QProcess *process = new QProcess(this);
+        // Let its warnings go wherever ours do
+        process->setProcessChannelMode(QProcess::ForwardedErrorChannel);
+        connect(process, &QProcess::readyReadStandardOutput,
+                this, [this, worker]() { readReplies(worker); });
+        connect(process, &QProcess::finished,
+                this, [this, worker]() { workerFinished(worker); });
+
+        {
+            QMutexLocker locker(&mutex);
+            worker->process = process;
+        }
+        process->start(QCoreApplication::applicationFilePath(),
+                       QStringList() << RENDER_WORKER_OPTION
+                                     << "--memory-limit"
+                                     << QString::number(memoryLimit));
+        if (!process->waitForStarted()) {
+            workerFinished(worker);
+            return;
+        }
+
+        QMutexLocker locker(&mutex);
+        worker->processId = process->processId();
+    }
+
+    worker->process->write(frame(id, request));
+}
+
+/*
+ * Tell a worker to stop working on a request, if it still is.
+ */
+void RenderWorkerPool::sendAbort(Worker *worker, quint32 id)
+{
+    QMutexLocker locker(&mutex);
+    if (worker->process != nullptr && worker->requestId == id
+        && !worker->hasReply)
+        worker->process->write(frame(id, QByteArray(1, (char)Abort)));
+}
+
+/*
+ * Kill a worker that stopped responding to the specified request. Another
+ * will be started the next time we send it one.
+ */
+void RenderWorkerPool::restart(Worker *worker, quint32 id)
+{
+    QMutexLocker locker(&mutex);
+    if (worker->process != nullptr) {
+        disconnect(worker->process, nullptr, this, nullptr);
+        worker->process->kill();
+        // It has to be gone before we can clean up after it
+        worker->process->waitForFinished(1000);
+        worker->process->deleteLater();
+        worker->process = nullptr;
+        removeSegment(worker->processId, id);
+    }
+    worker->buffer.clear();
+    worker->paths.clear();
+    worker->closing.clear();
+}
+
+/*
+ * Pick out complete replies from whatever a worker has sent us.
+ */
+void RenderWorkerPool::readReplies(Worker *worker)
+{
+    QMutexLocker locker(&mutex);
+    worker->buffer += worker->process->readAllStandardOutput();
+
+    while (worker->buffer.size() >= HEADER_SIZE) {
+        quint32 size, id;
+        QDataStream header(worker->buffer.left(HEADER_SIZE));
+        header >> size >> id;
+        if (worker->buffer.size() < (qsizetype)(HEADER_SIZE + size))
+            break;  // wait for the rest
+
+        // Anything else is from a request we've given up on
+        if (id == worker->requestId && worker->isBusy && !worker->hasReply) {
+            worker->reply = worker->buffer.mid(HEADER_SIZE, size);
+            worker->hasReply = true;
+            replied.wakeAll();
+        }
+        worker->buffer.remove(0, HEADER_SIZE + size);
+    }
+}
+
+/*
+ * Clean up after a worker that exited, presumably because it crashed.
+ */
+void RenderWorkerPool::workerFinished(Worker *worker)
+{
+    QMutexLocker locker(&mutex);
+    worker->process->deleteLater();
+    worker->process = nullptr;
+    worker->buffer.clear();
+    worker->paths.clear();
+    worker->closing.clear();
+    // Unless it got its last page to us first, and someone's about to
+    // pick it up
+    if (!(worker->isBusy && worker->hasReply))
+        removeSegment(worker->processId, worker->requestId);
+
+    if (worker->isBusy && !worker->hasReply) {
+        worker->error = "The renderer stopped unexpectedly.";
+        worker->hasReply = true;
+        replied.wakeAll();
+    }
+}
+
+/*
+ * Delete the page a dead worker may have left in shared memory for the
+ * last request we sent it. The worker deletes its earlier ones itself, so
+ * this is the only one we might not have attached to yet, and the system
+ * would keep it until reboot. Attaching and detaching again deletes it,
+ * since nothing else has it attached anymore.
+ */
+void RenderWorkerPool::removeSegment(qint64 processId, quint32 requestId)
+{
+    if (processId == 0 || requestId == 0)
+        return;
+
+    QSharedMemory segment;
+    segment.setKey(renderSegmentKey(processId, requestId));
+    if (segment.attach(QSharedMemory::ReadOnly))
+        segment.detach();
+}
+
+/*
+ * Set up a worker process. Arguments are the program's command line.
+ */
+RenderWorker::RenderWorker(const QStringList &arguments)
+{
+    isWorkerProcess = true;
+    inputClosed = false;
+    currentId = abortedId = 0;
+
+    int index = arguments.indexOf("--memory-limit");
+    if (index >= 0 && index + 1 < arguments.size())
+        setMemoryLimit(arguments[index + 1].toLongLong());
+
+    // Libraries sometimes print things, which we can't have mixed up with
+    // our replies, so keep standard output to ourselves
+#ifdef Q_OS_WIN
+    int outputFd = _dup(1);
+    _dup2(2, 1);
+    _setmode(0, _O_BINARY);
+    _setmode(outputFd, _O_BINARY);
+#else
+    int outputFd = dup(1);
+    dup2(2, 1);
+#endif
+    input.open(0, QIODevice::ReadOnly | QIODevice::Unbuffered);
+    output.open(outputFd, QIODevice::WriteOnly | QIODevice::Unbuffered,
+                QFileDevice::AutoCloseHandle);
+
+    reader = QThread::create([this]() { readRequests(); });
+}
+
+RenderWorker::~RenderWorker()
+{
+    reader->wait();
+    delete reader;
+    qDeleteAll(renderers);
+}
+
+/*
+ * Handle requests until there aren't any more, and return an exit code.
+ */
+int RenderWorker::exec()
+{
+    reader->start();
+
+    Request request;
+    while (takeRequest(&request)) {
+        // The application has the last page we sent by now
+        segment.reset();
+
+        QDataStream in(request.data);
+        quint8 command;
+        in >> command;
+
+        QByteArray reply;
+        if (command == RenderWorkerPool::Open)
+            reply = open(in);
+        else if (command == RenderWorkerPool::PageSizes)
+            reply = pageSizes(in);
+        else if (command == RenderWorkerPool::Render)
+            reply = render(in);
+        else if (command == RenderWorkerPool::Close)
+            reply = close(in);
+        else
+            reply = failure("Unknown request.");
+
+        output.write(frame(request.id, reply));
+
+        // Let renderers do anything they put off until we were idle
+        QCoreApplication::processEvents();
+    }
+    return 0;
+}
+
+/*
+ * Wait for the next request. Returns false if there won't be any more.
+ */
+bool RenderWorker::takeRequest(Request *request)
+{
+    QMutexLocker locker(&requestsMutex);
+    while (requests.isEmpty() && !inputClosed)
+        requestArrived.wait(&requestsMutex);
+    if (requests.isEmpty())
+        return false;
+
+    *request = requests.takeFirst();
+    currentId = request->id;
+    // It may have been cancelled before we even got to it
+    progress.aborted.storeRelaxed(request->id == abortedId);
+    return true;
+}
+
+/*
+ * Load a file and describe its pages. Renderers that work out page sizes
+ * gradually send what they have so far, which the application can follow
+ * up on with a PageSizes request.
+ */
+QByteArray RenderWorker::open(QDataStream &in)
+{
+    QString path;
+    in >> path;
+
+    QString error;
+    PagedContentRenderer *renderer = rendererFor(path, &error);
+    if (renderer == nullptr)
+        return failure(error);
+
+    QByteArray reply = success();
+    QDataStream out(&reply, QIODevice::WriteOnly | QIODevice::Append);
+    out << pageSizesOf(renderer) << renderer->supportsDrafts();
+    return reply;
+}
+
+/*
+ * Send the size of every page, looking up any we don't know yet.
+ */
+QByteArray RenderWorker::pageSizes(QDataStream &in)
+{
+    QString path;
+    in >> path;
+
+    QString error;
+    PagedContentRenderer *renderer = rendererFor(path, &error);
+    if (renderer == nullptr)
+        return failure(error);
+
+    // This can take a while on long documents, so let it be abandoned
+    renderer->runTask([renderer]() { renderer->finishPageSizes(); },
+                      &progress);
+    if (progress.aborted.loadRelaxed())
+        return reply(RenderWorkerPool::Aborted);
+
+    QByteArray reply = success();
+    QDataStream out(&reply, QIODevice::WriteOnly | QIODevice::Append);
+    out << pageSizesOf(renderer);
+    return reply;
+}
+
+/*
+ * Render a page and put it in shared memory for the application.
+ */
+QByteArray RenderWorker::render(QDataStream &in)
+{
+    QString path;
+    RenderRequest request;
+    in >> path >> request;
+
+    QString error;
+    PagedContentRenderer *renderer = rendererFor(path, &error);
+    if (renderer == nullptr)
+        return failure(error);
+
+    renderedImage = QImage();
+    renderError.clear();
+    if (!renderer->render(request, &progress)) {
+        if (progress.aborted.loadRelaxed())
+            return reply(RenderWorkerPool::Aborted);
+        return failure(renderError);
+    }
+
+    QString key = renderSegmentKey(QCoreApplication::applicationPid(),
+                                   currentId);
+    segment.reset(new QSharedMemory);
+    segment->setKey(key);
+    if (!segment->create(renderedImage.sizeInBytes())) {
+        error = segment->errorString();
+        segment.reset();
+        return failure(error);
+    }
+
+    // Nobody else writes to this, and the application doesn't read it
+    // until we've replied, so there's no need to lock it
+    std::memcpy(segment->data(), renderedImage.constBits(),
+                renderedImage.sizeInBytes());
+
+    QByteArray reply = this->reply(RenderWorkerPool::Succeeded, key);
+    QDataStream out(&reply, QIODevice::WriteOnly | QIODevice::Append);
+    out << renderedImage.size() << (qint64)renderedImage.bytesPerLine()
+        << (quint32)renderedImage.format() << renderedImage.colorTable();
+    return reply;
+}
+
+/*
+ * Close a file so the application can rename it.
+ */
+QByteArray RenderWorker::close(QDataStream &in)
+{
+    QString path;
+    in >> path;
+
+    for (int i = 0; i < renderers.size(); ++i) {
+        if (renderers[i]->path() == path) {
+            delete renderers.takeAt(i);
+            break;
+        }
+    }
+    return success();
+}
+
+/*
+ * Return a renderer for a file, loading it if it isn't already open.
+ */
+PagedContentRenderer *RenderWorker::rendererFor(const QString &path,
+                                                QString *errorOut)
+{
+    for (int i = 0; i < renderers.size(); ++i) {
+        if (renderers[i]->path() == path) {
+            renderers.move(i, 0);
+            return renderers[0];
+        }
+    }
+
+    Renderer *renderer = Renderer::create(path, errorOut);
+    if (renderer == nullptr)
+        return nullptr;
+    else if (renderer->mode() != Renderer::PagedContent) {
+        *errorOut = "This file is not a paged document.";
+        delete renderer;
+        return nullptr;
+    }
+
+    // Page sizes are sent in points, to be scaled by the application.
+    // Requests carry their own resolution, so this is only for those.
+    PagedContentRenderer *pagedRenderer = (PagedContentRenderer*)renderer;
+    pagedRenderer->setPixelDensity(72, 72);
+    pagedRenderer->setZoomFactor(100);
+    QObject::connect(pagedRenderer, &PagedContentRenderer::renderedPage,
+                     [this](const RenderRequest &, const QImage &image) {
+                         renderedImage = image;
+                     });
+    QObject::connect(pagedRenderer, &Renderer::errorEncountered,
+                     [this](const QString &details) {
+                         renderError = details;
+                     });
+
+    renderers.prepend(pagedRenderer);
+    if (renderers.size() > RENDER_WORKER_FILES)
+        delete renderers.takeLast();
+    return pagedRenderer;
+}
+
+/*
+ * Read requests as they arrive. This runs on its own thread, so we can
+ * stop work on a request partway through if we're asked to.
+ */
+void RenderWorker::readRequests()
+{
+    for (;;) {
+        QByteArray header = readFully(HEADER_SIZE);
+        if (header.size() < HEADER_SIZE)
+            break;
+
+        quint32 size, id;
+        QDataStream(header) >> size >> id;
+        QByteArray data = readFully(size);
+        if (data.size() < (qsizetype)size)
+            break;
+
+        QMutexLocker locker(&requestsMutex);
+        if (data.size() == 1 && (quint8)data[0] == RenderWorkerPool::Abort) {
+            abortedId = id;
+            if (id == currentId)
+                progress.aborted.storeRelaxed(1);
+        } else {
+            requests.append(Request{id, data});
+            requestArrived.wakeOne();
+        }
+    }
+
+    QMutexLocker locker(&requestsMutex);
+    inputClosed = true;
+    requestArrived.wakeOne();
+}
+
+/*
+ * Read exactly this much input, or less if it ends first.
+ */
+QByteArray RenderWorker::readFully(qint64 size)
+{
+    QByteArray data(size, Qt::Uninitialized);
+    qint64 done = 0;
+    while (done < size) {
+        qint64 count = input.read(data.data() + done, size - done);
+        if (count <= 0)
+            break;
+        done += count;
+    }
+    data.truncate(done);
+    return data;
+}
+
+/*
+ * Don't let a bad file use up all the memory we have.
+ */
+void RenderWorker::setMemoryLimit(qint64 mebibytes)
+{
+    if (mebibytes <= 0)
+        return;
+#ifdef Q_OS_UNIX
+    struct rlimit limit;
+    limit.rlim_cur = limit.rlim_max = (rlim_t)mebibytes * 1024 * 1024;
+    setrlimit(RLIMIT_AS, &limit);
+#endif
+}
+
+/*
+ * Return the size of every page as far as the renderer knows, in points.
+ */
+QList<QSize> RenderWorker::pageSizesOf(const PagedContentRenderer *renderer)
+{
+    QList<QSize> sizes;
+    sizes.reserve(renderer->numPages());
+    for (int i = 0; i < renderer->numPages(); ++i)
+        sizes.append(renderer->pageSize(i));
+    return sizes;
+}
+
+/*
+ * Start a reply. Anything else the request returns goes after this.
+ */
+QByteArray RenderWorker::reply(RenderWorkerPool::Status status,
+                               const QString &segmentKey,
+                               const QString &error)
+{
+    QByteArray reply;
+    QDataStream out(&reply, QIODevice::WriteOnly);
+    out << (quint8)status << error << segmentKey;
+    return reply;
+}
+
+/*
+ * Return the name of the shared memory segment a worker puts the page it
+ * rendered for a request in.
+ */
+QString renderSegmentKey(qint64 processId, quint32 requestId)
+{
+    return QString("renamifier-%1-%2").arg(processId).arg(requestId);
+}
+
+QDataStream &operator<<(QDataStream &out, const RenderRequest &request)
+{
+    return out << request.page << request.zoomFactor
+               << request.dpiX << request.dpiY
+               << request.region << request.draft;
+}
+
+QDataStream &operator>>(QDataStream &in, RenderRequest &request)
+{
+    return in >> request.page >> request.zoomFactor
+              >> request.dpiX >> request.dpiY
+              >> request.region >> request.draft;
+}
+
+/*
+ * Wrap a message up for sending.
+ */
+QByteArray frame(quint32 id, const QByteArray &data)
+{
+    QByteArray bytes;
+    QDataStream out(&bytes, QIODevice::WriteOnly);
+    out << (quint32)data.size() << id;
+    bytes.append(data);
+    return bytes;
+}
@@ -0,0 +1,217 @@
+/*
+ * Rendering in separate worker processes.
+ * Copyright (c) 2026 Benjamin Johnson
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef RENDER_WORKER_H
+#define RENDER_WORKER_H
+
+#include <memory>       // for std::unique_ptr
+
+#include <QObject>
+#include <QByteArray>
+#include <QDataStream>
+#include <QFile>
+#include <QList>
+#include <QMutex>
+#include <QProcess>
+#include <QSet>
+#include <QSharedMemory>
+#include <QString>
+#include <QStringList>
+#include <QThread>
+#include <QWaitCondition>
+
+#include "renderer.h"
+
+// Default settings
+#define DEFAULT_ISOLATED_RENDERING false
+#define DEFAULT_RENDER_WORKER_MEMORY 2048   // in MiB each, or 0 for no limit
+
+// Give up on a worker that takes longer than this to answer, in ms
+#define RENDER_WORKER_TIMEOUT 30000
+// Opening a file can take much longer, since it may have to be converted
+// first, and so can looking up the size of every page
+#define RENDER_WORKER_OPEN_TIMEOUT 300000
+
+// Started with this as its first argument, the program runs as a worker
+#define RENDER_WORKER_OPTION "--render-worker"
+
+/*
+ * Runs renderers in a pool of separate processes, so a file that crashes
+ * or hangs the rendering library can't take the application with it.
+ *
+ * Each worker is another copy of this program, started with
+ * RENDER_WORKER_OPTION, which loads files with Renderer::create() as usual
+ * and keeps the last few open. Requests and replies go back and forth over
+ * its standard input and output. Rendered pages come back in a shared
+ * memory segment, which becomes the image's pixels instead of being copied.
+ *
+ * Workers that crash or stop answering are killed, and replaced the next
+ * time one is needed. Requests that were in progress fail, so the worst a
+ * bad file can do is fail to display. Each page's segment is named after
+ * the worker's process ID and the request, so we can clean up any it left
+ * behind.
+ *
+ * This is optional (see isEnabled()), since every worker keeps its own
+ * copy of each document it renders. Use RemoteRenderer to render a file
+ * this way; it's what Renderer::create() returns when this is enabled.
+ */
+class RenderWorkerPool : public QObject
+{
+    Q_OBJECT
+
+public:
+    static bool isEnabled();
+    static RenderWorkerPool *instance();
+
+    // What requests are for
+    enum Command : quint8 { Open, PageSizes, Render, Close, Abort };
+    // How they turned out
+    enum Status : quint8 { Succeeded, Failed, Aborted };
+
+    struct Reply {
+        Status status;
+        QString error;          // if it failed
+        QByteArray data;        // whatever else the worker sent back
+        QSharedMemory *segment; // if it sent a page, or nullptr
+    };
+
+    // Send a request for a file to a worker, and wait for the reply.
+    // If a renderer is specified, the request is abandoned as soon as its
+    // shouldAbort() says so. Call this from any thread but the pool's.
+    Reply call(const QString &path, const QByteArray &request,
+               const PagedContentRenderer *renderer = nullptr,
+               int timeout = RENDER_WORKER_TIMEOUT);
+
+    // Make sure no worker keeps this file open, without waiting for them
+    void closeFile(const QString &path);
+
+private:
+    RenderWorkerPool();
+    ~RenderWorkerPool();
+    static void shutdown();
+
+    struct Worker {
+        QProcess *process;      // or nullptr if it needs to be (re)started
+        qint64 processId;       // of the last process we started, or 0
+        QByteArray buffer;      // replies as they come in
+        QSet<QString> paths;    // files it has open
+        QSet<QString> closing;  // files to close once it's free
+        bool isBusy;
+        // The request it's working on, and how it turned out
+        quint32 requestId;
+        bool hasReply;
+        QByteArray reply;
+        QString error;
+    };
+
+    // Note the mutex must already be locked for these
+    Worker *acquire(const QString &path);
+    void release(Worker *worker);
+    void sendClose(Worker *worker, const QString &path);
+    Reply callWorker(Worker *worker, const QByteArray &request,
+                     const PagedContentRenderer *renderer, int timeout);
+
+    // These run on the pool's thread
+    void send(Worker *worker, quint32 id, const QByteArray &request);
+    void sendAbort(Worker *worker, quint32 id);
+    void restart(Worker *worker, quint32 id);
+    void readReplies(Worker *worker);
+    void workerFinished(Worker *worker);
+    static void removeSegment(qint64 processId, quint32 requestId);
+
+    QList<Worker*> workers;
+    int maxWorkers;
+    quint32 lastRequestId;
+    QMutex mutex;
+    QWaitCondition replied;
+    QWaitCondition workerFreed;
+
+    static RenderWorkerPool *instance_;
+    static QThread *thread_;
+};
+
+/*
+ * The other end of a RenderWorkerPool: handles requests in a worker
+ * process until the application closes its standard input.
+ */
+class RenderWorker
+{
+public:
+    RenderWorker(const QStringList &arguments);
+    ~RenderWorker();
+    int exec();
+
+private:
+    struct Request {
+        quint32 id;
+        QByteArray data;
+    };
+
+    bool takeRequest(Request *request);
+    QByteArray open(QDataStream &in);
+    QByteArray pageSizes(QDataStream &in);
+    QByteArray render(QDataStream &in);
+    QByteArray close(QDataStream &in);
+    PagedContentRenderer *rendererFor(const QString &path,
+                                      QString *errorOut);
+
+    static QList<QSize> pageSizesOf(const PagedContentRenderer *renderer);
+    static QByteArray reply(RenderWorkerPool::Status status,
+                            const QString &segmentKey = QString(),
+                            const QString &error = QString());
+    static inline QByteArray success()
+        { return reply(RenderWorkerPool::Succeeded); }
+    static inline QByteArray failure(const QString &error)
+        { return reply(RenderWorkerPool::Failed, QString(), error); }
+
+    // These run on the reader thread
+    void readRequests();
+    QByteArray readFully(qint64 size);
+
+    static void setMemoryLimit(qint64 mebibytes);
+
+    QFile input, output;
+    QThread *reader;
+
+    // Requests waiting to be handled, or end of input
+    QList<Request> requests;
+    bool inputClosed;
+    QMutex requestsMutex;
+    QWaitCondition requestArrived;
+
+    // The request being handled, and the last one we were told to
+    // abandon, which may not have been handled yet
+    quint32 currentId;
+    quint32 abortedId;
+    RenderProgress progress;
+
+    // Open files, most recently used first
+    QList<PagedContentRenderer*> renderers;
+    // Most recent page rendered, and what went wrong if it wasn't
+    QImage renderedImage;
+    QString renderError;
+    // Holds the last page we sent until the application has it too
+    std::unique_ptr<QSharedMemory> segment;
+};
+
+QString renderSegmentKey(qint64 processId, quint32 requestId);
+QDataStream &operator<<(QDataStream &out, const RenderRequest &request);
+QDataStream &operator>>(QDataStream &in, RenderRequest &request);
+
+#endif /* RENDER_WORKER_H */
@@ -21,6 +21,15 @@
 
 #include "renderer.h"
 
+// A render can be interrupted for more urgent work once it has taken this
+// many milliseconds, so one slow page never holds up the visible ones for
+// longer than this
+#define RENDER_TIME_SLICE 100
+
+// Send unfinished pages to the viewer at most this often, in milliseconds,
+// so slow pages appear gradually without flooding the main thread
+#define PARTIAL_IMAGE_INTERVAL 200
+
 /*
  * Construct a new Renderer.
  */
@@ -58,6 +67,8 @@ QString Renderer::findHelper(const QString &settingName,
 
 /*
  * Run an external program to convert a file into something we can display.
+ * Files that need this are loaded as tasks the scheduler limits the number
+ * of (see usesHelper() and RenderScheduler::run()), so this never waits.
  *
  * Returns the raw data as a QByteArray.
  */
@@ -79,6 +90,35 @@ QByteArray Renderer::runHelper(const QString &program,
     return nullptr;
 }
 
+RenderRequest::RenderRequest(int page, int zoomFactor, int dpiX, int dpiY,
+                             const QRect &region, bool draft)
+    : region(region)
+{
+    this->page = page;
+    this->zoomFactor = zoomFactor;
+    this->dpiX = dpiX;
+    this->dpiY = dpiY;
+    this->draft = draft;
+}
+
+bool RenderRequest::operator==(const RenderRequest &other) const
+{
+    return (page == other.page
+            && zoomFactor == other.zoomFactor
+            && dpiX == other.dpiX
+            && dpiY == other.dpiY
+            && region == other.region
+            && draft == other.draft);
+}
+
+RenderProgress::RenderProgress()
+{
+    aborted = 0;
+    preempted = 0;
+    lastPartialImage = 0;
+    promise = nullptr;
+}
+
 TextContentRenderer::TextContentRenderer()
     : Renderer()
 {
@@ -90,8 +130,20 @@ PagedContentRenderer::PagedContentRenderer()
     // Default to the DPI of a standard PC screen
     dpiX_ = dpiY_ = 96;
     zoomFactor_ = 100;
+
+    renderCost = -1;
+
+    // Errors come from whichever thread is rendering the page they're
+    // about, so that's where to note which page it was
+    connect(this, &Renderer::errorEncountered,
+            this, [](const QString &details) {
+                if (currentProgress != nullptr)
+                    currentProgress->error = details;
+            }, Qt::DirectConnection);
 }
 
+thread_local RenderProgress *PagedContentRenderer::currentProgress = nullptr;
+
 /*
  * We enforce a lower limit on these values to keep our page geometry
  * from getting spicy, but otherwise we don't question them. If the
@@ -110,3 +162,183 @@ void PagedContentRenderer::setZoomFactor(int percent)
     if (percent > 0)
         zoomFactor_ = percent;
 }
+
+/*
+ * Render a page and pass it back if successful, returning whether it was.
+ * This is called by the scheduler on one of its threads, which keeps
+ * track of the page's progress.
+ */
+bool PagedContentRenderer::render(const RenderRequest &request,
+                                  RenderProgress *progress)
+{
+    QImage image = renderImage(request, progress);
+    if (image.isNull())
+        return false;
+
+    emit renderedPage(request, image);
+    return true;
+}
+
+/*
+ * Render a page and return it in its storage format, or a null image if
+ * it couldn't be rendered or nobody wants it anymore.
+ */
+QImage PagedContentRenderer::renderImage(const RenderRequest &request,
+                                         RenderProgress *progress)
+{
+    progress->request = request;
+    progress->lastPartialImage = 0;
+    progress->error.clear();
+    progress->clock.start();
+
+    currentProgress = progress;
+    QImage image = renderPage(request);
+    currentProgress = nullptr;
+
+    // Don't bother with a page nobody wants anymore, even if we finished it
+    if (image.isNull() || progress->aborted.loadRelaxed())
+        return QImage();
+
+    // Converting here keeps the work off the main thread, and the result
+    // is what the viewer and the caches hold on to
+    image = toStorageFormat(image);
+
+    qint64 pixels = (qint64)image.width() * image.height();
+    if (!request.draft && pixels > 0) {
+        // Weight recent pages more heavily, since they're likely to be
+        // more like the next one
+        int cost = qMin(progress->clock.nsecsElapsed() * 1000 / pixels,
+                        (qint64)INT_MAX);
+        int average = renderCost.loadRelaxed();
+        renderCost.storeRelaxed((average < 0) ? cost
+                                              : (3 * average + cost) / 4);
+    }
+
+    return image;
+}
+
+/*
+ * Run a task for this renderer, which can check shouldAbort() like a page.
+ * This is called by the scheduler on one of its threads.
+ */
+void PagedContentRenderer::runTask(const std::function<void()> &task,
+                                   RenderProgress *progress)
+{
+    progress->request = RenderRequest();
+    progress->lastPartialImage = 0;
+    progress->error.clear();
+    progress->clock.start();
+
+    currentProgress = progress;
+    task();
+    currentProgress = nullptr;
+}
+
+/*
+ * Return whether it's time to send the viewer what we have of the page
+ * so far. Drafts are fast enough that there's no point, and the viewer
+ * only shows whole pages as they render, not tiles.
+ */
+bool PagedContentRenderer::wantsPartialImage() const
+{
+    const RenderProgress *progress = currentProgress;
+    return (progress != nullptr && !progress->request.draft
+            && progress->request.region.isNull()
+            && progress->clock.elapsed() - progress->lastPartialImage
+               >= PARTIAL_IMAGE_INTERVAL);
+}
+
+void PagedContentRenderer::partialImage(const QImage &image)
+{
+    RenderProgress *progress = currentProgress;
+    if (progress == nullptr)
+        return;
+
+    progress->lastPartialImage = progress->clock.elapsed();
+    // The renderer is still drawing on this, so the viewer needs a copy
+    emit renderedPartialPage(progress->request, image.copy());
+}
+
+bool PagedContentRenderer::shouldAbort() const
+{
+    const RenderProgress *progress = currentProgress;
+    return (progress != nullptr
+            && (progress->aborted.loadRelaxed()
+                || (progress->promise != nullptr
+                    && progress->promise->isCanceled())
+                || (progress->preempted.loadRelaxed()
+                    && progress->clock.elapsed() > RENDER_TIME_SLICE)));
+}
+
+/*
+ * Convert an image to the most compact format that holds it exactly.
+ *
+ * Most of what we display is scanned documents, which are often grayscale
+ * or black and white even when they're stored or rendered in color, so
+ * those become 8-bit grayscale or 1-bit monochrome. Everything else is
+ * converted to RGB32 for opaque images and premultiplied ARGB32 for the
+ * rest, so it can be painted without converting it again.
+ */
+QImage PagedContentRenderer::toStorageFormat(const QImage &image)
+{
+    QImage rgb;
+    switch (image.format()) {
+    case QImage::Format_Invalid:
+    case QImage::Format_Mono:
+    case QImage::Format_MonoLSB:
+    case QImage::Format_Grayscale8:
+        return image;   // already as small as it gets
+    case QImage::Format_Grayscale16:
+        return image.convertToFormat(QImage::Format_Grayscale8);
+    case QImage::Format_RGB32:
+    case QImage::Format_ARGB32:
+    case QImage::Format_ARGB32_Premultiplied:
+        rgb = image;    // these are the same for opaque pixels
+        break;
+    default:
+        rgb = image.convertToFormat(image.hasAlphaChannel()
+                                    ? QImage::Format_ARGB32
+                                    : QImage::Format_RGB32);
+        break;
+    }
+
+    // Each row is checked without branching, which lets the compiler
+    // vectorize it, and we give up at the end of the first row with color
+    // or transparency
+    quint32 notGray = 0, notBilevel = 0;
+    for (int y = 0; y < rgb.height() && notGray == 0; y++) {
+        const quint32 *line = (const quint32*)rgb.constScanLine(y);
+        for (int x = 0; x < rgb.width(); x++) {
+            quint32 pixel = line[x];
+            quint32 r = (pixel >> 16) & 0xff;
+            quint32 g = (pixel >> 8) & 0xff;
+            quint32 b = pixel & 0xff;
+            notGray |= (r ^ g) | (g ^ b) | (~pixel >> 24);
+            notBilevel |= (b + 1) & 0xfe;   // zero only for 0 and 255
+        }
+    }
+
+    if (notGray != 0)
+        return rgb.convertToFormat(rgb.hasAlphaChannel()
+                                   ? QImage::Format_ARGB32_Premultiplied
+                                   : QImage::Format_RGB32);
+    else if (notBilevel != 0)
+        return rgb.convertToFormat(QImage::Format_Grayscale8);
+    else
+        return rgb.convertToFormat(QImage::Format_Mono, Qt::ThresholdDither);
+}
+
+/*
+ * Guess how long a full-quality render of the specified size will take,
+ * in milliseconds, based on how long previous pages took.
+ * Returns -1 if we have nothing to go on yet.
+ */
+int PagedContentRenderer::estimatedRenderTime(const QSize &size) const
+{
+    int cost = renderCost.loadRelaxed();
+    if (cost < 0)
+        return -1;
+
+    qint64 pixels = (qint64)size.width() * size.height();
+    return pixels * cost / 1000000000;
+}
@@ -20,8 +20,15 @@
 #ifndef RENDERER_H
 #define RENDERER_H
 
+#include <functional>     // for std::function
+
 #include <QObject>  // inherited by basically everything else
+#include <QAtomicInt>
 #include <QByteArray>
+#include <QElapsedTimer>
+#include <QMetaType>
+#include <QPromise>
+#include <QRect>
 #include <QSize>
 #include <QString>
 #include <QImage>
@@ -50,9 +57,16 @@ class Renderer : public QObject
 public:
     static Renderer *create(const QString &path,
                             QString *errorOut = nullptr);
+    static bool usesHelper(const QString &path);
     static void init();
 
     inline QString path() const { return path_; }
+    // Call this only after the file has actually been renamed
+    inline void setPath(const QString &path) { path_ = path; }
+
+    // Override this and return true if the renderer holds the file open
+    // after it's loaded, so the caller knows to delete it before renaming
+    virtual bool keepsFileOpen() const { return false; }
 
     enum Mode { TextContent, PagedContent };
     virtual Renderer::Mode mode() const = 0;
@@ -101,15 +115,82 @@ signals:
     void renderedText(const QString &text);
 };
 
+// Pages with more pixels than this are rendered in square tiles instead of
+// all at once, so memory use depends on how much of the page is visible
+// rather than how big it is
+#define MAX_UNTILED_PIXELS (4096 * 4096)
+#define TILE_SIZE 512
+
+/*
+ * A request to render one page of a paged document, or part of one.
+ *
+ * Requests carry their own rendering parameters so the results can't be
+ * confused with those of an earlier request for the same page.
+ */
+struct RenderRequest {
+    RenderRequest(int page = -1, int zoomFactor = 100,
+                  int dpiX = 96, int dpiY = 96,
+                  const QRect &region = QRect(), bool draft = false);
+    bool operator==(const RenderRequest &other) const;
+    inline bool operator!=(const RenderRequest &other) const
+        { return !(*this == other); }
+
+    // Resolution to render at, including the zoom factor
+    inline int scaledDpiX() const { return dpiX * zoomFactor / 100; }
+    inline int scaledDpiY() const { return dpiY * zoomFactor / 100; }
+
+    int page;
+    int zoomFactor;
+    int dpiX, dpiY;
+    QRect region;   // in rendered pixels, or null for the whole page
+    bool draft;     // trade quality for speed (see supportsDrafts())
+};
+Q_DECLARE_METATYPE(RenderRequest)
+
+/*
+ * The answer to a request made through RenderScheduler::request().
+ */
+struct RenderResult {
+    RenderRequest request;
+    QImage image;       // the page, or null if it couldn't be rendered
+    QString text;       // the contents, for text renderers
+    QString error;      // what went wrong, if the renderer said
+};
+
+/*
+ * How far along a page is. The scheduler keeps one of these for each of
+ * its threads, and sets the flags from other threads to interrupt it.
+ */
+struct RenderProgress {
+    RenderProgress();
+
+    RenderRequest request;
+    QAtomicInt aborted;         // nobody wants this page anymore
+    QAtomicInt preempted;       // something more urgent is waiting
+    QElapsedTimer clock;        // time spent on this page so far
+    qint64 lastPartialImage;    // in clock time
+    QString error;              // last error reported for this page
+    // Where the page goes if it was requested with a future, or nullptr
+    QPromise<RenderResult> *promise;
+};
+
 /*
  * Base class for paged content renderers.
  *
- * renderPage() is called through a signal from the viewer. It passes back
- * a QImage of the requested page's contents via the renderedPage signal.
+ * Pages are requested through a RenderScheduler, which decides what to
+ * render next across all renderers. Each rendered page is passed back as
+ * a QImage via the renderedPage signal, or through a future if it was
+ * requested with one, already converted to the most compact format that
+ * holds it exactly (see toStorageFormat()).
  *
- * Your subclass should also implement numPages(), which returns the total
- * number of pages in the file, and pageSize(), which returns the dimensions
- * in pixels of the specified page.
+ * Your subclass should implement renderPage(), which renders the page
+ * described by a request; numPages(), which returns the total number of
+ * pages in the file; and pageSize(), which returns the dimensions in pixels
+ * of the specified page.
+ *
+ * The scheduler may call renderPage() from several threads at once, for
+ * different pages of the same document, so it must not change anything
+ * shared between calls without locking it first.
  */
 class PagedContentRenderer : public Renderer {
     Q_OBJECT
@@ -117,9 +198,13 @@ class PagedContentRenderer : public Renderer {
 public:
     virtual int numPages() const = 0;
     virtual QSize pageSize(int num) const = 0;  // in pixels
+    // Whether every page is the same size as the first, so there's no need
+    // to ask about the others
+    virtual bool hasUniformPageSizes() const { return numPages() <= 1; }
 
     inline Renderer::Mode mode() const { return PagedContent; }
 
+    // These are used by pageSize(); requests carry their own copies
     inline int dpiX() const { return dpiX_; }
     inline int dpiY() const { return dpiY_; }
     void setPixelDensity(int dpiX, int dpiY);
@@ -130,23 +215,74 @@ public:
     inline bool pageExists(int num) const
         { return (0 <= num && num < numPages()); }
 
-public slots:
-    virtual void renderPage(int num) = 0;
+    // Whether a page this size should be rendered in tiles
+    static inline bool isTiled(const QSize &size)
+        { return (qint64)size.width() * size.height() > MAX_UNTILED_PIXELS; }
+
+    // Whether draft requests are any faster than regular ones.
+    // Drafts may be smaller than the page, and should be scaled up to fit.
+    virtual bool supportsDrafts() const { return false; }
+    // Whether a draft of this page is known to cost next to nothing,
+    // so it's always worth having
+    virtual bool hasInstantDraft(int) const { return false; }
+    int estimatedRenderTime(const QSize &size) const;
+
+    // Renderers that work out page sizes gradually should override this to
+    // finish the job, for callers that can't wait for pageSizesChanged().
+    // It may stop early if shouldAbort() says so.
+    virtual void finishPageSizes() {}
+
+    // Whether the page being rendered is no longer wanted, or should make
+    // way for something more urgent. renderPage() should check this every
+    // so often if it can, and return a null image if it gives up.
+    bool shouldAbort() const;
+
+    static QImage toStorageFormat(const QImage &image);
 
 protected:
     PagedContentRenderer();
 
+    // Return a null image if the page couldn't be rendered
+    // (and emit errorEncountered() to explain why)
+    virtual QImage renderPage(const RenderRequest &request) = 0;
+
     inline int zoomScaled(int value) const
         { return (zoomFactor_ == 100) ? value : value * zoomFactor_ / 100; }
     inline QSize zoomScaled(const QSize &size) const
         { return (zoomFactor_ == 100) ? size : size * zoomFactor_ / 100; }
 
+    // Renderers that can show a page before it's finished should check
+    // this every so often, and pass what they have to partialImage()
+    bool wantsPartialImage() const;
+    void partialImage(const QImage &image);
+
 private:
+    friend class RenderScheduler;
+    friend class RenderWorker;
+    bool render(const RenderRequest &request, RenderProgress *progress);
+    QImage renderImage(const RenderRequest &request,
+                       RenderProgress *progress);
+    void runTask(const std::function<void()> &task,
+                 RenderProgress *progress);
+
     int dpiX_, dpiY_;
     int zoomFactor_;
+    // Average time for a full-quality render, in microseconds per
+    // megapixel, or -1 if we haven't rendered anything yet
+    QAtomicInt renderCost;
+
+    // The page this thread is rendering or the task it's running, if any
+    static thread_local RenderProgress *currentProgress;
 
 signals:
-    void renderedPage(int num, const QImage &image);
+    void renderedPage(const RenderRequest &request, const QImage &image);
+    // Pages that take a while are also sent in stages as they're rendered
+    void renderedPartialPage(const RenderRequest &request,
+                             const QImage &image);
+    // Emitted if pageSize() turns out to have been wrong for some pages
+    void pageSizesChanged();
+    // Emitted if pages rendered so far would look different now
+    void pagesChanged();
 };
 
 #endif /* RENDERER_H */
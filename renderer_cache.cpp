@@ -0,0 +1,655 @@
+/*
+ * Keeps renderers ready for files the user is likely to view soon.
+ * Copyright (c) 2026 Benjamin Johnson
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <QtCore>
+
+#ifdef Q_OS_UNIX
+#include <sys/stat.h>
+#endif
+
+#include "renderer_cache.h"
+#include "renderer_loader.h"
+#include "renderer.h"
+#include "render_scheduler.h"
+
+static QString fileId(const QString &path);
+
+/* ------------------------------------------------------------------------ */
+
+RenderParameters::RenderParameters()
+{
+    zoomFactor = 100;
+    dpiX = dpiY = 96;
+    devicePixelRatio = 1.0;
+}
+
+bool RenderParameters::operator==(const RenderParameters &other) const
+{
+    return (zoomFactor == other.zoomFactor
+            && dpiX == other.dpiX
+            && dpiY == other.dpiY
+            && devicePixelRatio == other.devicePixelRatio
+            && viewportSize == other.viewportSize);
+}
+
+/* ------------------------------------------------------------------------ */
+
+struct RendererCache::Entry {
+    Entry(const QString &path);
+
+    QString path;
+    int loadId;         // nonzero while loading
+    bool wanted;        // requested through take() rather than prefetch()
+    bool recent;        // retained after the viewer was done with it
+    Renderer *renderer;
+    PageImages pageImages;
+    RenderParameters pageParameters;    // how pageImages were rendered
+    qint64 bytes;       // memory reserved for pageImages
+    // Memory reserved for pages that haven't come back yet, by page number
+    QMap<int, qint64> pendingBytes;
+
+    // Used to detect whether the file has changed since we last saw it,
+    // or been replaced by another that happens to look the same
+    qint64 fileSize;
+    QDateTime lastModified;
+    QString fileId;
+};
+
+RendererCache::Entry::Entry(const QString &path)
+    : path(path)
+{
+    loadId = 0;
+    wanted = false;
+    recent = false;
+    renderer = nullptr;
+    bytes = 0;
+    fileSize = -1;
+}
+
+/* ------------------------------------------------------------------------ */
+
+RendererCache::RendererCache(QThread *renderThread,
+                             RenderScheduler *scheduler, QObject *parent)
+    : QObject(parent)
+{
+    this->renderThread = renderThread;
+    this->scheduler = scheduler;
+    cachedBytes = 0;
+    lastLoadId = 0;
+
+    loader = new RendererLoader;
+    loader->moveToThread(renderThread);
+    // Renderers always run on the render thread regardless of which
+    // of the scheduler's threads loaded them
+    loader->setTargetThread(renderThread);
+    connect(loader, &RendererLoader::loaded,
+            this, &RendererCache::rendererLoaded);
+    connect(loader, &RendererLoader::loadFailed,
+            this, &RendererCache::rendererLoadFailed);
+}
+
+/*
+ * Note this must be destroyed before the render thread is stopped,
+ * since that's where our renderers are deleted.
+ */
+RendererCache::~RendererCache()
+{
+    loader->cancelAll();
+    while (!entries.isEmpty())
+        discard(entries.first());
+
+    // Nothing must be using the loader by the time it's deleted
+    scheduler->finishTasks(loader);
+    loader->deleteLater();
+}
+
+/*
+ * Return a renderer for the specified path if one is ready, and store any
+ * pages that have already been rendered in pageImages.
+ *
+ * The caller takes ownership of the renderer.
+ *
+ * If the renderer is not ready, this returns nullptr and starts loading it
+ * if that isn't already happening.
+ */
+Renderer *RendererCache::take(const QString &path, PageImages *pageImages)
+{
+    Entry *entry = find(path);
+    if (entry != nullptr && entry->recent && !isUnchanged(entry)) {
+        // What we have is out of date
+        discard(entry);
+        entry = nullptr;
+    }
+
+    if (entry == nullptr) {
+        entry = new Entry(path);
+        entries.append(entry);
+        load(entry, true);
+    } else if (entry->renderer == nullptr && entry->loadId == 0)
+        load(entry, true);  // see releaseFile()
+
+    if (entry->renderer == nullptr) {
+        // Report back when it's done, even if this started as a prefetch
+        entry->wanted = true;
+        return nullptr;
+    }
+
+    Renderer *renderer = entry->renderer;
+    disconnect(renderer, nullptr, this, nullptr);
+    cancelPages(renderer);
+    if (pageImages != nullptr)
+        *pageImages = entry->pageImages;
+
+    cachedBytes -= entry->bytes;
+    entries.removeOne(entry);
+    delete entry;
+    return renderer;
+}
+
+/*
+ * Indicate the caller is no longer waiting for the specified path.
+ */
+void RendererCache::release(const QString &path)
+{
+    Entry *entry = find(path);
+    if (entry != nullptr && entry->wanted) {
+        entry->wanted = false;
+        if (!(entry->recent || prefetchPaths.contains(path)))
+            discard(entry);
+    }
+}
+
+/*
+ * Discard anything we have for the specified path.
+ */
+void RendererCache::forget(const QString &path)
+{
+    Entry *entry = find(path);
+    if (entry != nullptr)
+        discard(entry);
+}
+
+/*
+ * Keep a renderer the caller is done with, along with the pages it has
+ * rendered, in case the user returns to the same file.
+ *
+ * We take ownership of the renderer.
+ */
+void RendererCache::retain(Renderer *renderer, const PageImages &pageImages)
+{
+    // Replace anything we already had for this file
+    Entry *entry = find(renderer->path());
+    if (entry != nullptr)
+        discard(entry);
+
+    entry = new Entry(renderer->path());
+    entry->recent = true;
+    entry->renderer = renderer;
+    entry->pageImages = pageImages;
+
+    if (renderer->mode() == Renderer::PagedContent) {
+        PagedContentRenderer *paged = (PagedContentRenderer*)renderer;
+        entry->pageParameters.zoomFactor = paged->zoomFactor();
+        entry->pageParameters.dpiX = paged->dpiX();
+        entry->pageParameters.dpiY = paged->dpiY();
+        connect(paged, &PagedContentRenderer::pagesChanged,
+                this, &RendererCache::pagesChanged, Qt::UniqueConnection);
+    }
+
+    PageImages::const_iterator i;
+    for (i = pageImages.constBegin(); i != pageImages.constEnd(); ++i)
+        entry->bytes += i.value().sizeInBytes();
+    cachedBytes += entry->bytes;
+
+    QFileInfo fi(entry->path);
+    entry->fileSize = fi.size();
+    entry->lastModified = fi.lastModified();
+    entry->fileId = fileId(entry->path);
+
+    // Keep these in order from least to most recently used
+    entries.append(entry);
+    enforceLimits();
+}
+
+/*
+ * Prepare renderers for the specified paths, in order of priority.
+ *
+ * Anything previously prefetched that isn't in this list is discarded,
+ * so call this again whenever the list of upcoming files changes.
+ */
+void RendererCache::prefetch(const QStringList &paths)
+{
+    prefetchPaths = paths;
+
+    // Throw out anything we don't need anymore
+    QList<Entry*> existing = entries;
+    for (int i = 0; i < existing.size(); ++i) {
+        Entry *entry = existing[i];
+        if (!(entry->wanted || entry->recent || paths.contains(entry->path)))
+            discard(entry);
+    }
+
+    for (int i = 0; i < paths.size(); ++i) {
+        if (find(paths[i]) == nullptr) {
+            Entry *entry = new Entry(paths[i]);
+            entries.append(entry);
+            load(entry, false);
+        }
+    }
+}
+
+/*
+ * Update the parameters used to render prefetched pages.
+ * Anything rendered with the old parameters is thrown out and redone.
+ */
+void RendererCache::setRenderParameters(const RenderParameters &parameters)
+{
+    if (parameters == this->parameters)
+        return;
+
+    this->parameters = parameters;
+
+    // Recent files keep what they have, since we'd be rendering them again
+    // purely on speculation. Note prefetchPages() may discard recent entries
+    // to make room, so we can't iterate over the live list.
+    QList<Entry*> prefetched;
+    for (int i = 0; i < entries.size(); ++i) {
+        if (!entries[i]->recent && entries[i]->renderer != nullptr)
+            prefetched.append(entries[i]);
+    }
+    for (int i = 0; i < prefetched.size(); ++i) {
+        discardPages(prefetched[i]);
+        prefetchPages(prefetched[i]);
+    }
+}
+
+/*
+ * Make sure no renderer is holding the specified file open.
+ *
+ * Any pages we've already rendered are kept, and the file is loaded again
+ * if it's needed later.
+ */
+void RendererCache::releaseFile(const QString &path)
+{
+    Entry *entry = find(path);
+    if (entry == nullptr)
+        return;
+
+    if (entry->loadId != 0) {
+        loader->cancel(entry->loadId);
+        entry->loadId = 0;
+    }
+
+    Renderer *renderer = entry->renderer;
+    if (renderer != nullptr && renderer->keepsFileOpen()) {
+        disconnect(renderer, nullptr, this, nullptr);
+        entry->renderer = nullptr;
+
+        // We can't return until the file is actually closed, so we can't
+        // just deleteLater() this like usual. First make sure none of the
+        // scheduler's threads are still using it.
+        if (renderer->mode() == Renderer::PagedContent)
+            scheduler->finish((PagedContentRenderer*)renderer);
+
+        // The loader is a convenient object on the render thread to run
+        // this in the context of. Nothing slow runs there, so this won't
+        // keep the user waiting.
+        QMetaObject::invokeMethod(loader, [renderer]() { delete renderer; },
+                                  Qt::BlockingQueuedConnection);
+    }
+}
+
+/*
+ * Update our records after a file has been renamed.
+ */
+void RendererCache::fileRenamed(const QString &oldPath, const QString &newPath)
+{
+    Entry *entry = find(oldPath);
+    if (entry == nullptr)
+        return;
+
+    entry->path = newPath;
+    // Where we can only go by the path, this is still the same file
+    if (!entry->fileId.isEmpty())
+        entry->fileId = fileId(newPath);
+    if (entry->renderer != nullptr)
+        entry->renderer->setPath(newPath);
+    else if (entry->loadId == 0)
+        load(entry, false);     // reopen what releaseFile() closed
+}
+
+RendererCache::Entry *RendererCache::find(const QString &path) const
+{
+    for (int i = 0; i < entries.size(); ++i) {
+        if (entries[i]->path == path)
+            return entries[i];
+    }
+    return nullptr;
+}
+
+RendererCache::Entry *RendererCache::findLoad(int id) const
+{
+    for (int i = 0; i < entries.size(); ++i) {
+        if (entries[i]->loadId == id)
+            return entries[i];
+    }
+    return nullptr;
+}
+
+RendererCache::Entry *RendererCache::findRenderer(
+    const QObject *renderer) const
+{
+    for (int i = 0; i < entries.size(); ++i) {
+        if (entries[i]->renderer == renderer)
+            return entries[i];
+    }
+    return nullptr;
+}
+
+/*
+ * Cancel or delete the specified entry's renderer, and remove the entry.
+ */
+void RendererCache::discard(Entry *entry)
+{
+    if (entry->loadId != 0) {
+        loader->cancel(entry->loadId);
+    }
+    if (entry->renderer != nullptr) {
+        disconnect(entry->renderer, nullptr, this, nullptr);
+        disposeRenderer(entry->renderer);
+    }
+
+    cachedBytes -= entry->bytes;
+    entries.removeOne(entry);
+    delete entry;
+}
+
+/*
+ * Discard the least recently used files if we're keeping too many,
+ * or using too much memory.
+ */
+void RendererCache::enforceLimits()
+{
+    QSettings settings;
+    int recentLimit = settings.value("cache/recentFiles",
+                                     DEFAULT_RECENT_FILES).toInt();
+    qint64 bytesLimit = memoryLimit();
+
+    int recentCount = 0;
+    for (int i = 0; i < entries.size(); ++i) {
+        if (entries[i]->recent)
+            ++recentCount;
+    }
+
+    for (int i = 0;
+         i < entries.size()
+         && (recentCount > recentLimit || cachedBytes > bytesLimit); ) {
+        Entry *entry = entries[i];
+        if (entry->recent && !entry->wanted) {
+            discard(entry);     // this removes it from the list
+            --recentCount;
+        } else
+            ++i;
+    }
+}
+
+/*
+ * Check whether a file has changed since we last saw it, and is still the
+ * same file and not another one that's taken its place.
+ */
+bool RendererCache::isUnchanged(const Entry *entry) const
+{
+    QFileInfo fi(entry->path);
+    return (fi.size() == entry->fileSize
+            && fi.lastModified() == entry->lastModified
+            && fileId(entry->path) == entry->fileId);
+}
+
+void RendererCache::load(Entry *entry, bool urgent)
+{
+    // IDs only need to be unique among loads that might still be in flight,
+    // so it doesn't matter if this eventually wraps around
+    if (++lastLoadId <= 0)
+        lastLoadId = 1;
+    entry->loadId = lastLoadId;
+
+    // Files the viewer is waiting for go ahead of everything but the pages
+    // it's showing, while prefetched files wait behind them
+    int id = entry->loadId;
+    QString path = entry->path;
+    RendererLoader *loader = this->loader;
+    RenderScheduler *scheduler = this->scheduler;
+    RenderScheduler::Priority priority = urgent ? RenderScheduler::Visible
+                                                : RenderScheduler::Prefetch;
+    loader->expect(id);
+
+    // Finding out whether the file needs a helper program means reading
+    // it, so that happens in the background too. If it does, the load goes
+    // back in the queue to wait for one.
+    scheduler->run(priority, loader,
+                   [loader, scheduler, priority, id, path]() {
+        if (Renderer::usesHelper(path)) {
+            scheduler->run(priority, loader,
+                           [loader, id, path]() { loader->load(id, path); },
+                           true);
+        } else
+            loader->load(id, path);
+    });
+}
+
+/*
+ * Render the pages that will be visible when this file is displayed,
+ * as far as the memory limit allows.
+ */
+void RendererCache::prefetchPages(Entry *entry)
+{
+    if (entry->renderer->mode() != Renderer::PagedContent)
+        return;
+
+    PagedContentRenderer *renderer = (PagedContentRenderer*)entry->renderer;
+    entry->pageParameters = parameters;
+    renderer->setZoomFactor(parameters.zoomFactor);
+    renderer->setPixelDensity(parameters.dpiX, parameters.dpiY);
+    connect(renderer, &PagedContentRenderer::renderedPage,
+            this, &RendererCache::pageRendered, Qt::UniqueConnection);
+
+    // This replaces any requests left over from earlier parameters
+    QList<RenderRequest> requests;
+    int y = 0, viewportHeight = parameters.viewportSize.height();
+    for (int i = 0; i < renderer->numPages() && y < viewportHeight; ++i) {
+        QSize size = renderer->pageSize(i);     // in physical pixels
+        if (PagedContentRenderer::isTiled(size))
+            break;  // the viewer only renders the visible part of these
+        // Reserve the memory now so other prefetches don't exceed the limit
+        // before this comes back. We won't know until then how compactly
+        // it can be stored, so assume the worst, and give back what it
+        // doesn't need when it arrives.
+        qint64 bytes = (qint64)size.width() * size.height() * 4
+                       - entry->pendingBytes.value(i);
+        if (!reserve(bytes))
+            break;
+        entry->bytes += bytes;
+        entry->pendingBytes[i] += bytes;
+        requests.append(RenderRequest(i, parameters.zoomFactor,
+                                      parameters.dpiX, parameters.dpiY));
+
+        y += size.height() / parameters.devicePixelRatio;
+    }
+    scheduler->submit(renderer, RenderScheduler::Prefetch, requests);
+}
+
+/*
+ * Stop rendering pages for this renderer, if it renders pages at all.
+ */
+void RendererCache::cancelPages(Renderer *renderer)
+{
+    if (renderer->mode() == Renderer::PagedContent)
+        scheduler->cancel((PagedContentRenderer*)renderer);
+}
+
+/*
+ * Delete a renderer once nothing is using it anymore.
+ */
+void RendererCache::disposeRenderer(Renderer *renderer)
+{
+    if (renderer->mode() == Renderer::PagedContent)
+        scheduler->dispose((PagedContentRenderer*)renderer);
+    else
+        renderer->deleteLater();
+}
+
+void RendererCache::discardPages(Entry *entry)
+{
+    entry->pageImages.clear();
+    entry->pendingBytes.clear();
+    cachedBytes -= entry->bytes;
+    entry->bytes = 0;
+}
+
+qint64 RendererCache::memoryLimit() const
+{
+    QSettings settings;
+    qint64 limit = settings.value("cache/memoryLimit",
+                                  DEFAULT_CACHE_MEMORY).toLongLong();
+    return limit * 1048576;     // convert MiB to bytes
+}
+
+/*
+ * Account for the specified amount of memory, discarding recent files
+ * if we need to make room.
+ *
+ * Returns true if successful, or false if there isn't enough room.
+ */
+bool RendererCache::reserve(qint64 bytes)
+{
+    qint64 bytesLimit = memoryLimit();
+    for (int i = 0; i < entries.size() && cachedBytes + bytes > bytesLimit; ) {
+        if (entries[i]->recent && !entries[i]->wanted)
+            discard(entries[i]);
+        else
+            ++i;
+    }
+
+    if (cachedBytes + bytes > bytesLimit)
+        return false;
+    cachedBytes += bytes;
+    return true;
+}
+
+void RendererCache::rendererLoaded(int id, Renderer *renderer)
+{
+    Entry *entry = findLoad(id);
+    if (entry == nullptr) {
+        // This was discarded while the signal was in transit
+        disposeRenderer(renderer);
+        return;
+    }
+
+    entry->loadId = 0;
+    entry->renderer = renderer;
+
+    if (renderer->mode() == Renderer::PagedContent) {
+        PagedContentRenderer *paged = (PagedContentRenderer*)renderer;
+        connect(paged, &PagedContentRenderer::pagesChanged,
+                this, &RendererCache::pagesChanged, Qt::UniqueConnection);
+        if (!entry->pageImages.isEmpty()) {
+            // This was reloaded after releaseFile(), so make sure the pages
+            // we kept still match
+            paged->setZoomFactor(entry->pageParameters.zoomFactor);
+            paged->setPixelDensity(entry->pageParameters.dpiX,
+                                   entry->pageParameters.dpiY);
+        }
+    }
+
+    if (entry->wanted)
+        emit ready(entry->path);
+    else if (!entry->recent && entry->pageImages.isEmpty())
+        prefetchPages(entry);
+}
+
+void RendererCache::rendererLoadFailed(int id, const QString &details)
+{
+    Entry *entry = findLoad(id);
+    if (entry == nullptr)
+        return;
+
+    // Don't keep this around; if the user displays this file later,
+    // loading it again will show them what went wrong
+    QString path = entry->path;
+    bool wanted = entry->wanted;
+    discard(entry);
+
+    if (wanted)
+        emit loadFailed(path, details);
+}
+
+void RendererCache::pageRendered(const RenderRequest &request,
+                                 const QImage &image)
+{
+    Entry *entry = findRenderer(sender());
+    if (entry == nullptr)
+        return;
+
+    // Ignore pages rendered with parameters we've since moved on from
+    const RenderParameters &current = entry->pageParameters;
+    if (request.zoomFactor != current.zoomFactor
+        || request.dpiX != current.dpiX || request.dpiY != current.dpiY)
+        return;
+
+    // Charge what the page actually takes instead of what we reserved
+    qint64 bytes = image.sizeInBytes() - entry->pendingBytes.take(request.page)
+                   - entry->pageImages.value(request.page).sizeInBytes();
+    entry->bytes += bytes;
+    cachedBytes += bytes;
+    entry->pageImages.insert(request.page, image);
+}
+
+/*
+ * Throw out pages the renderer would now draw differently, and render
+ * them again if we'd prefetched them.
+ */
+void RendererCache::pagesChanged()
+{
+    Entry *entry = findRenderer(sender());
+    if (entry == nullptr)
+        return;
+
+    discardPages(entry);
+    if (!entry->recent)
+        prefetchPages(entry);
+}
+
+/*
+ * Identify a file by its device and inode number, which stay the same
+ * when it's renamed but not when it's replaced. Returns an empty string
+ * if the file doesn't exist.
+ */
+QString fileId(const QString &path)
+{
+#ifdef Q_OS_UNIX
+    struct stat st;
+    if (stat(QFile::encodeName(path).constData(), &st) != 0)
+        return QString();
+    return QString("%1:%2").arg(st.st_dev).arg(st.st_ino);
+#else
+    // Qt doesn't tell us the file ID on other platforms,
+    // so the best we can do is the path
+    return QFileInfo(path).canonicalFilePath();
+#endif
+}
@@ -0,0 +1,142 @@
+/*
+ * Keeps renderers ready for files the user is likely to view soon.
+ * Copyright (c) 2026 Benjamin Johnson
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef RENDERER_CACHE_H
+#define RENDERER_CACHE_H
+
+#include <QObject>
+#include <QImage>
+#include <QList>
+#include <QMap>
+#include <QSize>
+#include <QString>
+#include <QStringList>
+#include <QThread>
+
+// Default settings
+#define DEFAULT_PREFETCH_FILES 2
+#define DEFAULT_RECENT_FILES 2
+#define DEFAULT_CACHE_MEMORY 256        // MiB
+
+class Renderer;
+class RendererLoader;
+class RenderScheduler;
+struct RenderRequest;
+
+// Rendered page images, indexed by page number
+typedef QMap<int, QImage> PageImages;
+
+/*
+ * Everything the prefetcher needs to know to render pages the same way
+ * the viewer would.
+ */
+struct RenderParameters {
+    RenderParameters();
+    bool operator==(const RenderParameters &other) const;
+    inline bool operator!=(const RenderParameters &other) const
+        { return !(*this == other); }
+
+    int zoomFactor;
+    int dpiX, dpiY;
+    qreal devicePixelRatio;
+    QSize viewportSize;         // in logical pixels
+};
+
+/*
+ * Loads renderers for the Viewer, and keeps them for files it will
+ * probably want soon.
+ *
+ * Call take() to get a renderer. If one is ready, it's returned right
+ * away along with any pages already rendered; otherwise the cache starts
+ * loading it and emits ready() or loadFailed() when it's done. Call take()
+ * again after ready() to actually claim the renderer.
+ *
+ * prefetch() loads upcoming files in the background at low priority, and
+ * renders the pages that will be visible when each is first displayed.
+ * Both are submitted to the scheduler behind anything the viewer needs.
+ *
+ * retain() keeps a renderer the viewer is done with, along with its pages,
+ * in case the user goes back to that file. Only a few of these are kept,
+ * and the least recently used are discarded first.
+ *
+ * Cached pages from both sources are limited to a configurable amount of
+ * memory, with prefetched files taking priority over recent ones.
+ *
+ * Before renaming a file, call releaseFile() so we don't hold it open,
+ * then fileRenamed() so we can find it again under its new name.
+ */
+class RendererCache : public QObject
+{
+    Q_OBJECT
+
+public:
+    RendererCache(QThread *renderThread, RenderScheduler *scheduler,
+                  QObject *parent = nullptr);
+    ~RendererCache();
+
+    Renderer *take(const QString &path, PageImages *pageImages = nullptr);
+    void release(const QString &path);
+    void forget(const QString &path);
+    void retain(Renderer *renderer, const PageImages &pageImages);
+    void prefetch(const QStringList &paths);
+    void setRenderParameters(const RenderParameters &parameters);
+
+    void releaseFile(const QString &path);
+    void fileRenamed(const QString &oldPath, const QString &newPath);
+
+private:
+    struct Entry;
+
+    Entry *find(const QString &path) const;
+    Entry *findLoad(int id) const;
+    Entry *findRenderer(const QObject *renderer) const;
+    void cancelPages(Renderer *renderer);
+    void discard(Entry *entry);
+    void disposeRenderer(Renderer *renderer);
+    void enforceLimits();
+    bool isUnchanged(const Entry *entry) const;
+    void load(Entry *entry, bool urgent);
+    qint64 memoryLimit() const;
+    void prefetchPages(Entry *entry);
+    void discardPages(Entry *entry);
+    bool reserve(qint64 bytes);
+
+    QThread *renderThread;
+    RenderScheduler *scheduler;
+    // Files are loaded on the scheduler's threads, at a priority that
+    // depends on whether the viewer is waiting for them
+    RendererLoader *loader;
+    QList<Entry*> entries;
+    QStringList prefetchPaths;
+    RenderParameters parameters;
+    qint64 cachedBytes;
+    int lastLoadId;
+
+private slots:
+    void rendererLoaded(int id, Renderer *renderer);
+    void rendererLoadFailed(int id, const QString &details);
+    void pageRendered(const RenderRequest &request, const QImage &image);
+    void pagesChanged();
+
+signals:
+    void ready(const QString &path);
+    void loadFailed(const QString &path, const QString &details);
+};
+
+#endif /* RENDERER_CACHE_H */
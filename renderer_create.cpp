@@ -18,12 +18,10 @@
  */
 
 #include <QString>
-#include <QMutex>
-#include <QMutexLocker>
-#include <QMimeType>
-#include <QMimeDatabase>
 
+#include "file_type.h"
 #include "renderer.h"
+#include "render_worker.h"
 
 // Available renderers
 // List alphabetically by name
@@ -31,11 +29,13 @@
 #include "render_image.h"
 #include "render_pdf.h"
 #include "render_ps.h"
+#include "render_remote.h"
 #include "render_text.h"
 #include "render_xps.h"
 
-static QString loadError;
-static QMutex loadErrorMutex;
+// load() runs on the thread that called create(), so keeping this per
+// thread lets files load in parallel without mixing up their errors
+static thread_local QString loadError;
 
 /*
  * Return an appropriate renderer subclass for the specified path.
@@ -44,34 +44,37 @@ static QMutex loadErrorMutex;
 Renderer *Renderer::create(const QString &path, QString *errorOut)
 {
     Renderer *renderer;
-    QMimeDatabase mimeDatabase;
-    QMimeType mimeType = mimeDatabase.mimeTypeForFile(path);
 
-    QMutexLocker locker(&loadErrorMutex);
-    loadError.clear();
-
-    // Specific MIME types
-    // List alphabetically by name
-    if (mimeType.inherits("application/oxps")
-        || mimeType.inherits("application/xps"))
-        renderer = new XPSRenderer;
-
-    else if (mimeType.inherits("application/pdf"))
-        renderer = new PDFRenderer;
+    // Formats whose libraries we'd rather keep at arm's length
+    bool isolated = RenderWorkerPool::isEnabled();
 
-    else if (mimeType.inherits("application/postscript"))
-        renderer = new PSRenderer;
+    loadError.clear();
 
-    // More generic MIME types
-    // These come last since more specific types may inherit from them
-    else if (mimeType.name().startsWith("image/"))
+    switch (FileType::identify(path)) {
+    case FileType::Image:
         renderer = new ImageRenderer;
-    else if (mimeType.inherits("text/plain"))
+        break;
+    case FileType::PDF:
+        renderer = isolated ? (Renderer*)new RemoteRenderer
+                            : (Renderer*)new PDFRenderer;
+        break;
+    case FileType::PostScript:
+        renderer = isolated ? (Renderer*)new RemoteRenderer
+                            : (Renderer*)new PSRenderer;
+        break;
+    case FileType::Text:
         renderer = new TextRenderer;
+        break;
+    case FileType::XPS:
+        renderer = isolated ? (Renderer*)new RemoteRenderer
+                            : (Renderer*)new XPSRenderer;
+        break;
 
     // Fallback if we can't identify this file
-    else
+    default:
         renderer = new HexDumpRenderer;
+        break;
+    }
 
     renderer->path_ = path;
     if (!(renderer->loaded_ = renderer->load())) {
@@ -84,6 +87,16 @@ Renderer *Renderer::create(const QString &path, QString *errorOut)
     return renderer;
 }
 
+/*
+ * Return whether create() will run a helper program to load this file,
+ * so the caller can limit how many of those run at once.
+ */
+bool Renderer::usesHelper(const QString &path)
+{
+    FileType::Type type = FileType::identify(path);
+    return (type == FileType::PostScript || type == FileType::XPS);
+}
+
 /*
  * Initialize renderers that need additional configuration.
  */
@@ -94,7 +107,7 @@ void Renderer::init()
 
 /*
  * Store errors that occurred while loading the document.
- * Note the mutex has already been locked by Renderer::create().
+ * This must be called on the thread running Renderer::create().
  */
 void Renderer::storeLoadError(const QString &message)
 {
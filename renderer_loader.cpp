@@ -0,0 +1,97 @@
+/*
+ * Asynchronous renderer construction.
+ * Copyright (c) 2026 Benjamin Johnson
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <QtCore>
+
+#include "render_scheduler.h"
+#include "renderer_loader.h"
+
+RendererLoader::RendererLoader()
+    : QObject()
+{
+    targetThread = nullptr;
+}
+
+/*
+ * Register a request ID before passing it to load().
+ */
+void RendererLoader::expect(int id)
+{
+    QMutexLocker locker(&expectedMutex);
+    expected.insert(id);
+}
+
+/*
+ * Discard the result of the specified request.
+ */
+void RendererLoader::cancel(int id)
+{
+    QMutexLocker locker(&expectedMutex);
+    expected.remove(id);
+}
+
+void RendererLoader::cancelAll()
+{
+    QMutexLocker locker(&expectedMutex);
+    expected.clear();
+}
+
+/*
+ * Create a renderer for the specified path.
+ * This is where the actual work happens, so it should run on a worker thread.
+ */
+void RendererLoader::load(int id, const QString &path)
+{
+    // Don't waste time loading something nobody wants anymore
+    if (!isExpected(id))
+        return;
+
+    QString loadError;
+    Renderer *renderer = Renderer::create(path, &loadError);
+
+    // We may have been cancelled while the load was in progress.
+    // No one else has seen the renderer yet, but it may have started
+    // work of its own on the scheduler's threads.
+    if (!isExpected(id)) {
+        RenderScheduler *scheduler = RenderScheduler::instance();
+        if (renderer != nullptr && scheduler != nullptr
+            && renderer->mode() == Renderer::PagedContent)
+            scheduler->dispose((PagedContentRenderer*)renderer);
+        else
+            delete renderer;
+        return;
+    }
+    cancel(id);
+
+    // This has to happen here since only the object's current thread
+    // is allowed to push it to another one
+    if (renderer != nullptr && targetThread != nullptr)
+        renderer->moveToThread(targetThread);
+
+    if (renderer == nullptr)
+        emit loadFailed(id, loadError);
+    else
+        emit loaded(id, renderer);
+}
+
+bool RendererLoader::isExpected(int id)
+{
+    QMutexLocker locker(&expectedMutex);
+    return expected.contains(id);
+}
@@ -0,0 +1,75 @@
+/*
+ * Asynchronous renderer construction.
+ * Copyright (c) 2026 Benjamin Johnson
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef RENDERER_LOADER_H
+#define RENDERER_LOADER_H
+
+#include <QObject>
+#include <QMutex>
+#include <QSet>
+#include <QString>
+#include <QThread>
+
+#include "renderer.h"
+
+/*
+ * Creates renderers without blocking the user interface.
+ *
+ * Move the loader to a worker thread and connect a signal to its load()
+ * slot. Renderer::create() then runs on that thread, and the result comes
+ * back through the loaded() or loadFailed() signal. Renderers are created
+ * on the loader's thread, so they are already in the right place to run
+ * their slots there unless you specify another with setTargetThread().
+ *
+ * Each request carries an ID chosen by the caller, which must first be
+ * registered with expect(). Requests that are cancel()ed before the loader
+ * gets to them are skipped, and anything loaded for a request cancelled
+ * while it was in progress is discarded rather than handed back.
+ */
+class RendererLoader : public QObject
+{
+    Q_OBJECT
+
+public:
+    RendererLoader();
+
+    // Move loaded renderers to this thread before handing them back
+    inline void setTargetThread(QThread *thread) { targetThread = thread; }
+
+    // These are safe to call from any thread
+    void expect(int id);
+    void cancel(int id);
+    void cancelAll();
+
+public slots:
+    void load(int id, const QString &path);
+
+private:
+    bool isExpected(int id);
+
+    QThread *targetThread;
+    QSet<int> expected;
+    QMutex expectedMutex;
+
+signals:
+    void loaded(int id, Renderer *renderer);
+    void loadFailed(int id, const QString &details);
+};
+
+#endif /* RENDERER_LOADER_H */
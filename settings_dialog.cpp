@@ -23,6 +23,12 @@
 #include <QtWidgets>
 
 #include "settings_dialog.h"
+#include "renderer_cache.h"
+#include "page_cache.h"
+#include "preview_cache.h"
+#include "render_pdf.h"
+#include "render_scheduler.h"
+#include "render_worker.h"
 
 SettingsDialog::SettingsDialog(QWidget *parent)
     : QDialog(parent)
@@ -33,6 +39,8 @@ SettingsDialog::SettingsDialog(QWidget *parent)
     setLayout(mainLayout);
 
     createHelperSettings();
+    createPerformanceSettings();
+    createPDFSettings();
 
     createButtons();
     loadSettings();
@@ -91,6 +99,152 @@ void SettingsDialog::createHelperSettings()
             this, &SettingsDialog::accept);
 }
 
+void SettingsDialog::createPerformanceSettings()
+{
+    performanceGroupBox = new QGroupBox("Performance", this);
+    mainLayout->addWidget(performanceGroupBox);
+
+    performanceLayout = new QGridLayout(performanceGroupBox);
+    performanceLayout->setColumnStretch(1, 1);
+    performanceGroupBox->setLayout(performanceLayout);
+
+    prefetchFilesLabel = new QLabel("Files to load in advance:",
+                                    performanceGroupBox);
+    performanceLayout->addWidget(prefetchFilesLabel, 0, 0);
+
+    prefetchFilesSpinBox = new QSpinBox(performanceGroupBox);
+    prefetchFilesSpinBox->setRange(0, 10);
+    prefetchFilesLabel->setBuddy(prefetchFilesSpinBox);
+    performanceLayout->addWidget(prefetchFilesSpinBox, 0, 1);
+
+    recentFilesLabel = new QLabel("Recently viewed files to keep:",
+                                  performanceGroupBox);
+    performanceLayout->addWidget(recentFilesLabel, 1, 0);
+
+    recentFilesSpinBox = new QSpinBox(performanceGroupBox);
+    recentFilesSpinBox->setRange(0, 10);
+    recentFilesLabel->setBuddy(recentFilesSpinBox);
+    performanceLayout->addWidget(recentFilesSpinBox, 1, 1);
+
+    cacheMemoryLabel = new QLabel("Memory for these files' pages:",
+                                  performanceGroupBox);
+    performanceLayout->addWidget(cacheMemoryLabel, 2, 0);
+
+    cacheMemorySpinBox = new QSpinBox(performanceGroupBox);
+    cacheMemorySpinBox->setRange(0, 4096);
+    cacheMemorySpinBox->setSingleStep(16);
+    cacheMemorySpinBox->setSuffix(" MiB");
+    cacheMemoryLabel->setBuddy(cacheMemorySpinBox);
+    performanceLayout->addWidget(cacheMemorySpinBox, 2, 1);
+
+    pageCacheMemoryLabel = new QLabel("Memory for pages scrolled past:",
+                                      performanceGroupBox);
+    performanceLayout->addWidget(pageCacheMemoryLabel, 3, 0);
+
+    pageCacheMemorySpinBox = new QSpinBox(performanceGroupBox);
+    pageCacheMemorySpinBox->setRange(0, 4096);
+    pageCacheMemorySpinBox->setSingleStep(16);
+    pageCacheMemorySpinBox->setSuffix(" MiB");
+    pageCacheMemoryLabel->setBuddy(pageCacheMemorySpinBox);
+    performanceLayout->addWidget(pageCacheMemorySpinBox, 3, 1);
+
+    // Show how well the page cache is doing, to help choose a size for it
+    PageCache::Statistics stats = PageCache::statistics();
+    pageCacheStatsLabel = new QLabel(
+        QString("Since startup: %1 pages reused, %2 rendered again, "
+                "%3 discarded to save memory")
+            .arg(stats.hits).arg(stats.misses).arg(stats.evictions),
+        performanceGroupBox);
+    pageCacheStatsLabel->setWordWrap(true);
+    performanceLayout->addWidget(pageCacheStatsLabel, 4, 0, 1, 2);
+
+    previewDiskSpaceLabel = new QLabel("Disk space for first-page previews:",
+                                       performanceGroupBox);
+    performanceLayout->addWidget(previewDiskSpaceLabel, 5, 0);
+
+    previewDiskSpaceSpinBox = new QSpinBox(performanceGroupBox);
+    previewDiskSpaceSpinBox->setRange(0, 16384);
+    previewDiskSpaceSpinBox->setSingleStep(64);
+    previewDiskSpaceSpinBox->setSuffix(" MiB");
+    previewDiskSpaceSpinBox->setSpecialValueText("Off");
+    previewDiskSpaceLabel->setBuddy(previewDiskSpaceSpinBox);
+    performanceLayout->addWidget(previewDiskSpaceSpinBox, 5, 1);
+
+    renderThreadsLabel = new QLabel("Threads for background work:",
+                                    performanceGroupBox);
+    performanceLayout->addWidget(renderThreadsLabel, 6, 0);
+
+    renderThreadsSpinBox = new QSpinBox(performanceGroupBox);
+    renderThreadsSpinBox->setRange(0, QThread::idealThreadCount());
+    renderThreadsSpinBox->setSpecialValueText("Automatic");
+    renderThreadsSpinBox->setToolTip("Takes effect after restarting");
+    renderThreadsLabel->setBuddy(renderThreadsSpinBox);
+    performanceLayout->addWidget(renderThreadsSpinBox, 6, 1);
+
+    renderHelpersLabel = new QLabel("Helper programs to run at once:",
+                                    performanceGroupBox);
+    performanceLayout->addWidget(renderHelpersLabel, 7, 0);
+
+    renderHelpersSpinBox = new QSpinBox(performanceGroupBox);
+    renderHelpersSpinBox->setRange(1, QThread::idealThreadCount());
+    renderHelpersSpinBox->setToolTip("Takes effect after restarting");
+    renderHelpersLabel->setBuddy(renderHelpersSpinBox);
+    performanceLayout->addWidget(renderHelpersSpinBox, 7, 1);
+
+    isolatedRenderingCheckBox = new QCheckBox(
+        "Render documents in separate processes", performanceGroupBox);
+    isolatedRenderingCheckBox->setToolTip(
+        "Keeps damaged files from crashing the program, "
+        "at the cost of some memory");
+    performanceLayout->addWidget(isolatedRenderingCheckBox, 8, 0, 1, 2);
+
+    workerMemoryLabel = new QLabel("Memory limit for each process:",
+                                   performanceGroupBox);
+    performanceLayout->addWidget(workerMemoryLabel, 9, 0);
+
+    workerMemorySpinBox = new QSpinBox(performanceGroupBox);
+    workerMemorySpinBox->setRange(0, 16384);
+    workerMemorySpinBox->setSingleStep(256);
+    workerMemorySpinBox->setSuffix(" MiB");
+    workerMemorySpinBox->setSpecialValueText("Unlimited");
+    workerMemoryLabel->setBuddy(workerMemorySpinBox);
+    performanceLayout->addWidget(workerMemorySpinBox, 9, 1);
+
+    connect(isolatedRenderingCheckBox, &QCheckBox::toggled,
+            workerMemorySpinBox, &QWidget::setEnabled);
+}
+
+void SettingsDialog::createPDFSettings()
+{
+    pdfGroupBox = new QGroupBox("PDF Documents", this);
+    mainLayout->addWidget(pdfGroupBox);
+
+    pdfLayout = new QGridLayout(pdfGroupBox);
+    pdfLayout->setColumnStretch(1, 1);
+    pdfGroupBox->setLayout(pdfLayout);
+
+    pdfProfileLabel = new QLabel("Rendering method:", pdfGroupBox);
+    pdfLayout->addWidget(pdfProfileLabel, 0, 0);
+
+    // The automatic choice is made separately for each kind of document
+    pdfProfileComboBox = new QComboBox(pdfGroupBox);
+    pdfProfileComboBox->addItem("Fastest for each document", "auto");
+    QStringList profiles = PDFRenderer::profileNames();
+    for (int i = 0; i < profiles.size(); ++i)
+        pdfProfileComboBox->addItem(
+            PDFRenderer::profileDescription(profiles[i]), profiles[i]);
+    pdfProfileLabel->setBuddy(pdfProfileComboBox);
+    pdfLayout->addWidget(pdfProfileComboBox, 0, 1);
+
+    pdfOverprintCheckBox = new QCheckBox("Simulate overprinting",
+                                         pdfGroupBox);
+    pdfLayout->addWidget(pdfOverprintCheckBox, 1, 0, 1, 2);
+
+    pdfHideAnnotationsCheckBox = new QCheckBox("Hide annotations",
+                                               pdfGroupBox);
+    pdfLayout->addWidget(pdfHideAnnotationsCheckBox, 2, 0, 1, 2);
+}
+
 void SettingsDialog::createButtons()
 {
     buttonLayout = new QHBoxLayout;
@@ -116,6 +270,39 @@ void SettingsDialog::loadSettings()
 
     gsPathEdit->setPath(settings.value("helpers/gs").toString());
     gxpsPathEdit->setPath(settings.value("helpers/gxps").toString());
+
+    prefetchFilesSpinBox->setValue(
+        settings.value("prefetch/files", DEFAULT_PREFETCH_FILES).toInt());
+    recentFilesSpinBox->setValue(
+        settings.value("cache/recentFiles", DEFAULT_RECENT_FILES).toInt());
+    cacheMemorySpinBox->setValue(
+        settings.value("cache/memoryLimit", DEFAULT_CACHE_MEMORY).toInt());
+    pageCacheMemorySpinBox->setValue(
+        settings.value("cache/pageMemoryLimit",
+                       DEFAULT_PAGE_CACHE_MEMORY).toInt());
+    previewDiskSpaceSpinBox->setValue(
+        settings.value("cache/previewDiskSpace",
+                       DEFAULT_PREVIEW_DISK_SPACE).toInt());
+    renderThreadsSpinBox->setValue(
+        settings.value("render/threads", DEFAULT_RENDER_THREADS).toInt());
+    renderHelpersSpinBox->setValue(
+        settings.value("render/helpers", DEFAULT_RENDER_HELPERS).toInt());
+    isolatedRenderingCheckBox->setChecked(
+        settings.value("render/isolated",
+                       DEFAULT_ISOLATED_RENDERING).toBool());
+    workerMemorySpinBox->setEnabled(isolatedRenderingCheckBox->isChecked());
+    workerMemorySpinBox->setValue(
+        settings.value("render/workerMemory",
+                       DEFAULT_RENDER_WORKER_MEMORY).toInt());
+
+    int profileIndex = pdfProfileComboBox->findData(
+        settings.value("pdf/profile", DEFAULT_PDF_PROFILE).toString());
+    pdfProfileComboBox->setCurrentIndex(qMax(profileIndex, 0));
+    pdfOverprintCheckBox->setChecked(
+        settings.value("pdf/overprint", DEFAULT_PDF_OVERPRINT).toBool());
+    pdfHideAnnotationsCheckBox->setChecked(
+        settings.value("pdf/hideAnnotations",
+                       DEFAULT_PDF_HIDE_ANNOTATIONS).toBool());
 }
 
 void SettingsDialog::saveSettings()
@@ -133,6 +320,24 @@ void SettingsDialog::saveSettings()
         settings.remove("helpers/gxps");
     else
         settings.setValue("helpers/gxps", gxpsPath);
+
+    settings.setValue("prefetch/files", prefetchFilesSpinBox->value());
+    settings.setValue("cache/recentFiles", recentFilesSpinBox->value());
+    settings.setValue("cache/memoryLimit", cacheMemorySpinBox->value());
+    settings.setValue("cache/pageMemoryLimit",
+                      pageCacheMemorySpinBox->value());
+    settings.setValue("cache/previewDiskSpace",
+                      previewDiskSpaceSpinBox->value());
+    settings.setValue("render/threads", renderThreadsSpinBox->value());
+    settings.setValue("render/helpers", renderHelpersSpinBox->value());
+    settings.setValue("render/isolated",
+                      isolatedRenderingCheckBox->isChecked());
+    settings.setValue("render/workerMemory", workerMemorySpinBox->value());
+
+    settings.setValue("pdf/profile", pdfProfileComboBox->currentData());
+    settings.setValue("pdf/overprint", pdfOverprintCheckBox->isChecked());
+    settings.setValue("pdf/hideAnnotations",
+                      pdfHideAnnotationsCheckBox->isChecked());
 }
 
 PathEdit::PathEdit(QWidget *parent)
@@ -31,6 +31,9 @@
 #include <QLabel>
 #include <QLineEdit>
 #include <QPushButton>
+#include <QSpinBox>
+#include <QCheckBox>
+#include <QComboBox>
 
 class PathEdit;
 
@@ -53,11 +56,41 @@ private:
     QLabel *gxpsLabel;
     PathEdit *gxpsPathEdit;
 
+    QGroupBox *performanceGroupBox;
+    QGridLayout *performanceLayout;
+    QLabel *prefetchFilesLabel;
+    QSpinBox *prefetchFilesSpinBox;
+    QLabel *recentFilesLabel;
+    QSpinBox *recentFilesSpinBox;
+    QLabel *cacheMemoryLabel;
+    QSpinBox *cacheMemorySpinBox;
+    QLabel *pageCacheMemoryLabel;
+    QSpinBox *pageCacheMemorySpinBox;
+    QLabel *pageCacheStatsLabel;
+    QLabel *previewDiskSpaceLabel;
+    QSpinBox *previewDiskSpaceSpinBox;
+    QLabel *renderThreadsLabel;
+    QSpinBox *renderThreadsSpinBox;
+    QLabel *renderHelpersLabel;
+    QSpinBox *renderHelpersSpinBox;
+    QCheckBox *isolatedRenderingCheckBox;
+    QLabel *workerMemoryLabel;
+    QSpinBox *workerMemorySpinBox;
+
+    QGroupBox *pdfGroupBox;
+    QGridLayout *pdfLayout;
+    QLabel *pdfProfileLabel;
+    QComboBox *pdfProfileComboBox;
+    QCheckBox *pdfOverprintCheckBox;
+    QCheckBox *pdfHideAnnotationsCheckBox;
+
     QHBoxLayout *buttonLayout;
     QPushButton *buttonOK;
     QPushButton *buttonCancel;
 
     void createHelperSettings();
+    void createPerformanceSettings();
+    void createPDFSettings();
     void createButtons();
     void loadSettings();
     void saveSettings();
@@ -17,13 +17,28 @@
  * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
  */
 
+#include <algorithm>    // for std::sort()
+#include <cstring>      // for std::strcmp()
+
+#include <QApplication>
+#include <QGuiApplication>
+
 #include "test.h"
+#include "file_type.h"
+#include "page_cache.h"
+#include "renderer.h"
+#include "render_remote.h"
+#include "render_scheduler.h"
+#include "render_worker.h"
 
 /*
  * Initialize the test case.
  */
 void RenamifierTest::initTestCase()
 {
+    // Keep the preview cache out of the user's real cache directory
+    QStandardPaths::setTestModeEnabled(true);
+
     // Keep this in sync with test.qrc
     testFiles
         << "CMakeLists.txt"
@@ -112,6 +127,22 @@ void RenamifierTest::renameWorks()
     QVERIFY(QFileInfo(dstPath).exists());
 }
 
+/*
+ * Test that MainWindow::displayFile() doesn't wait for the file to load.
+ */
+void RenamifierTest::displayFileIsAsynchronous()
+{
+    addTestFiles();
+
+    // The renderer is handed back through a queued signal, so it can't
+    // possibly arrive before we return to the event loop
+    mainWindow->displayFile(0);
+    QVERIFY(mainWindow->viewer->isLoading());
+
+    // ...but it should arrive eventually
+    QTRY_VERIFY(!mainWindow->viewer->isLoading());
+}
+
 /*
  * Test that MainWindow::displayFile() wraps around.
  */
@@ -195,6 +226,486 @@ void RenamifierTest::renameAndMoveWithNothingOpen()
     QVERIFY(!mainWindow->processRenameAndMove());
 }
 
+/*
+ * Test that rendered pages are stored as compactly as their content allows.
+ */
+void RenamifierTest::storageFormats()
+{
+    QImage image(64, 64, QImage::Format_RGB32);
+
+    // Black and white
+    image.fill(Qt::white);
+    image.setPixel(10, 10, qRgb(0, 0, 0));
+    QCOMPARE(PagedContentRenderer::toStorageFormat(image).format(),
+             QImage::Format_Mono);
+
+    // Grayscale
+    image.setPixel(20, 20, qRgb(128, 128, 128));
+    QImage gray = PagedContentRenderer::toStorageFormat(image);
+    QCOMPARE(gray.format(), QImage::Format_Grayscale8);
+    QCOMPARE(gray.pixel(20, 20), qRgb(128, 128, 128));
+
+    // Color, even if only one pixel has any
+    image.setPixel(63, 63, qRgb(255, 0, 0));
+    QCOMPARE(PagedContentRenderer::toStorageFormat(image).format(),
+             QImage::Format_RGB32);
+
+    // Gray, but not opaque
+    QImage translucent(64, 64, QImage::Format_ARGB32);
+    translucent.fill(qRgba(128, 128, 128, 128));
+    QCOMPARE(PagedContentRenderer::toStorageFormat(translucent).format(),
+             QImage::Format_ARGB32_Premultiplied);
+}
+
+/*
+ * Confirm that looking for the same missing page over and over counts as
+ * one miss until it's been rendered and cached.
+ */
+void RenamifierTest::pageCacheMisses()
+{
+    PageCache cache;
+    PageCacheKey key(this, 0, -1, 100, 96, 96, 1);
+    QImage image(16, 16, QImage::Format_Mono);
+    image.fill(1);
+
+    PageCache::Statistics before = PageCache::statistics();
+    QVERIFY(cache.take(key).isNull());
+    QVERIFY(cache.take(key).isNull());
+    QCOMPARE(PageCache::statistics().misses, before.misses + 1);
+
+    cache.insert(key, image);
+    QVERIFY(!cache.take(key).isNull());
+    QCOMPARE(PageCache::statistics().hits, before.hits + 1);
+
+    QVERIFY(cache.take(key).isNull());
+    QCOMPARE(PageCache::statistics().misses, before.misses + 2);
+}
+
+/*
+ * Confirm that pages rendered in worker processes come back, that a page
+ * can be abandoned partway through, and that a worker crashing only fails
+ * the page it was working on.
+ */
+void RenamifierTest::renderWorkers()
+{
+    QTemporaryFile *file = renderTestFile(2);
+    QString errorMessage;
+    PagedContentRenderer *pagedRenderer =
+        openRenderTestFile(file, &errorMessage, true);
+    QVERIFY2(pagedRenderer != nullptr, qPrintable(errorMessage));
+    QVERIFY(qobject_cast<RemoteRenderer*>(pagedRenderer) != nullptr);
+    QCOMPARE(pagedRenderer->numPages(), 2);
+
+    // It may still be asking for its page sizes, which would start
+    // another worker at some point during the test
+    RenderScheduler::instance()->finish(pagedRenderer);
+
+    RenderScheduler scheduler(1);
+    RenderResult result = scheduler.request(
+        pagedRenderer, RenderScheduler::Visible, RenderRequest(0)).result();
+    QVERIFY2(!result.image.isNull(), qPrintable(result.error));
+    QCOMPARE(result.image.size(), pagedRenderer->pageSize(0));
+    QList<qint64> workers = renderWorkerIds();
+    QVERIFY(!workers.isEmpty());
+
+    // A worker told to stop should carry on with the next page,
+    // not be replaced
+    QFuture<RenderResult> slowPage = scheduler.request(
+        pagedRenderer, RenderScheduler::Visible, RenderRequest(1, 400));
+    QThread::msleep(200);
+    slowPage.cancel();
+    result = scheduler.request(
+        pagedRenderer, RenderScheduler::Visible, RenderRequest(1)).result();
+    QVERIFY2(!result.image.isNull(), qPrintable(result.error));
+    QCOMPARE(renderWorkerIds(), workers);
+
+    // A worker that crashes fails the page, and is replaced for the next
+    slowPage = scheduler.request(
+        pagedRenderer, RenderScheduler::Visible, RenderRequest(1, 400));
+    QThread::msleep(200);
+    killRenderWorkers();
+    result = slowPage.result();
+    QVERIFY(result.image.isNull());
+    QVERIFY(!result.error.isEmpty());
+    result = scheduler.request(
+        pagedRenderer, RenderScheduler::Visible, RenderRequest(0)).result();
+    QVERIFY2(!result.image.isNull(), qPrintable(result.error));
+    QList<qint64> replacements = renderWorkerIds();
+    QVERIFY(!replacements.isEmpty());
+    for (qint64 id : replacements)
+        QVERIFY(!workers.contains(id));
+
+    // Deleting the renderer has the workers close the file
+    closeRenderTestFile(pagedRenderer, &scheduler);
+    QString renamedPath = file->fileName() + ".renamed";
+    tempFiles.append(renamedPath);
+    QVERIFY(file->rename(renamedPath));
+    delete file;
+}
+
+/*
+ * Confirm that pages requested with a future come back through it,
+ * whether or not they could be rendered, and that abandoned pages leave
+ * their futures cancelled.
+ */
+void RenamifierTest::requestPages()
+{
+    QTemporaryFile *file = renderTestFile(2);
+    QString errorMessage;
+    PagedContentRenderer *pagedRenderer =
+        openRenderTestFile(file, &errorMessage);
+    QVERIFY2(pagedRenderer != nullptr, qPrintable(errorMessage));
+
+    int signalled = 0;
+    connect(pagedRenderer, &PagedContentRenderer::renderedPage,
+            this, [&signalled]() { ++signalled; }, Qt::QueuedConnection);
+
+    RenderScheduler scheduler(2);
+    QFuture<RenderResult> page = scheduler.request(
+        pagedRenderer, RenderScheduler::Visible, RenderRequest(1));
+    QFuture<RenderResult> missing = scheduler.request(
+        pagedRenderer, RenderScheduler::Visible, RenderRequest(2));
+
+    RenderResult result = page.result();
+    QVERIFY(result.request == RenderRequest(1));
+    QVERIFY(!result.image.isNull());
+    QCOMPARE(result.image.size(), pagedRenderer->pageSize(1));
+
+    result = missing.result();
+    QVERIFY(result.request == RenderRequest(2));
+    QVERIFY(result.image.isNull());
+
+    // The renderer's signal is for pages requested the usual way
+    QCoreApplication::processEvents();
+    QCOMPARE(signalled, 0);
+
+    // Whether the caller gives up on a page or the renderer's pages are
+    // cancelled, there's nothing to wait for
+    QFuture<RenderResult> first = scheduler.request(
+        pagedRenderer, RenderScheduler::Visible, RenderRequest(0, 400));
+    QFuture<RenderResult> second = scheduler.request(
+        pagedRenderer, RenderScheduler::Visible, RenderRequest(1, 400));
+    QFuture<RenderResult> third = scheduler.request(
+        pagedRenderer, RenderScheduler::Visible, RenderRequest(1, 300));
+    first.cancel();
+    scheduler.cancel(pagedRenderer);
+    for (QFuture<RenderResult> *future : {&first, &second, &third}) {
+        QTRY_VERIFY(future->isFinished());
+        QVERIFY(future->isCanceled());
+        QCOMPARE(future->resultCount(), 0);
+    }
+
+    closeRenderTestFile(pagedRenderer, &scheduler);
+    delete file;
+}
+
+/*
+ * Confirm that text comes back through a future along with any error,
+ * and that each request only gets its own.
+ */
+void RenamifierTest::requestText()
+{
+    QTemporaryFile *file = renameTestFile();
+    tempFiles.append(file->fileName());
+    QString errorMessage;
+    Renderer *renderer = Renderer::create(file->fileName(), &errorMessage);
+    QVERIFY2(renderer != nullptr, qPrintable(errorMessage));
+    QCOMPARE(renderer->mode(), Renderer::TextContent);
+    TextContentRenderer *textRenderer = (TextContentRenderer*)renderer;
+
+    // The renderer lives on this thread, so this is where it answers
+    RenderScheduler scheduler(1);
+    QFuture<RenderResult> text = scheduler.request(textRenderer);
+    QTRY_VERIFY(text.isFinished());
+    RenderResult result = text.result();
+    QVERIFY(!result.text.isEmpty());
+    QVERIFY(result.error.isEmpty());
+
+    QVERIFY(file->remove());
+    text = scheduler.request(textRenderer);
+    QTRY_VERIFY(text.isFinished());
+    result = text.result();
+    QVERIFY(result.text.isEmpty());
+    QVERIFY(!result.error.isEmpty());
+
+    // A request nobody wants by the time the renderer gets to it is
+    // dropped, and so is one for a renderer that's gone
+    text = scheduler.request(textRenderer);
+    text.cancel();
+    QTRY_VERIFY(text.isFinished());
+    QCOMPARE(text.resultCount(), 0);
+    text = scheduler.request(textRenderer);
+    delete renderer;
+    QTRY_VERIFY(text.isFinished());
+    QVERIFY(text.isCanceled());
+    QCOMPARE(text.resultCount(), 0);
+    delete file;
+}
+
+void RenamifierTest::fileTypes_data()
+{
+    QTest::addColumn<QByteArray>("contents");
+    QTest::addColumn<QString>("suffix");
+    QTest::addColumn<int>("type");
+
+    QTest::newRow("empty") << QByteArray() << "bin" << (int)FileType::Unknown;
+    QTest::newRow("empty text") << QByteArray() << "txt"
+                                << (int)FileType::Text;
+    QTest::newRow("text") << QByteArray("Hello, world!\n") << "txt"
+                          << (int)FileType::Text;
+    QTest::newRow("text named like a PDF") << QByteArray("Hello!\n") << "pdf"
+                                           << (int)FileType::Text;
+    QTest::newRow("text starting like a bitmap")
+        << QByteArray("BMX is a sport\n") << "txt" << (int)FileType::Text;
+    QTest::newRow("binary") << QByteArray("\x7f" "ELF\x02\x01\x01\0", 8)
+                            << "" << (int)FileType::Unknown;
+    QTest::newRow("PDF") << QByteArray("%PDF-1.7\n%\xe2\xe3\xcf\xd3\n")
+                         << "pdf" << (int)FileType::PDF;
+    QTest::newRow("PDF after junk")
+        << QByteArray("Junk\r\n%PDF-1.4\n") << "pdf" << (int)FileType::PDF;
+    QTest::newRow("PDF after binary junk")
+        << QByteArray("\0\0\0\0%PDF-1.4\n", 13) << "" << (int)FileType::PDF;
+    QTest::newRow("text mentioning PDF")
+        << QByteArray("echo %PDF-1.4 > out.pdf\n") << "sh"
+        << (int)FileType::Text;
+    QTest::newRow("PostScript") << QByteArray("%!PS-Adobe-3.0\n") << "ps"
+                                << (int)FileType::PostScript;
+    QTest::newRow("PostScript without a suffix")
+        << QByteArray("%!PS-Adobe-3.0\n") << "" << (int)FileType::PostScript;
+    QTest::newRow("text starting like PostScript")
+        << QByteArray("%!PS\n/Times-Roman findfont\n") << "txt"
+        << (int)FileType::Text;
+    QTest::newRow("PNG") << QByteArray("\x89PNG\r\n\x1a\n\0\0\0\rIHDR", 16)
+                         << "png" << (int)FileType::Image;
+    QTest::newRow("JPEG") << QByteArray("\xff\xd8\xff\xe0\0\x10JFIF\0", 11)
+                          << "jpg" << (int)FileType::Image;
+    QTest::newRow("SVG")
+        << QByteArray("<svg xmlns=\"http://www.w3.org/2000/svg\"/>\n")
+        << "svg" << (int)FileType::Image;
+    QTest::newRow("XPM") << QByteArray("/* XPM */\nstatic char *x[] = {\n")
+                         << "xpm" << (int)FileType::Image;
+    QTest::newRow("text starting like XPM")
+        << QByteArray("/* XPM */\nstatic char *x[] = {\n") << "txt"
+        << (int)FileType::Text;
+    QTest::newRow("XBM") << QByteArray("#define x_width 1\n") << "xbm"
+                         << (int)FileType::Image;
+    QTest::newRow("C header") << QByteArray("#define X 1\n") << "h"
+                              << (int)FileType::Text;
+    QTest::newRow("plain PBM") << QByteArray("P1\n1 1\n0\n") << "pbm"
+                               << (int)FileType::Image;
+    QTest::newRow("text starting like PBM")
+        << QByteArray("P1 is the first priority\n") << "txt"
+        << (int)FileType::Text;
+    QTest::newRow("XPS") << QByteArray("PK\x03\x04\x14\0\0\0", 8) << "xps"
+                         << (int)FileType::XPS;
+}
+
+/*
+ * Confirm that files are identified by their contents where possible,
+ * and that the cache agrees.
+ */
+void RenamifierTest::fileTypes()
+{
+    QFETCH(QByteArray, contents);
+    QFETCH(QString, suffix);
+    QFETCH(int, type);
+
+    QTemporaryDir dir;
+    QVERIFY(dir.isValid());
+    QFile file(dir.filePath(suffix.isEmpty() ? "sample" : "sample." + suffix));
+    QVERIFY(file.open(QIODevice::WriteOnly));
+    file.write(contents);
+    file.close();
+
+    QCOMPARE((int)FileType::detect(file.fileName()), type);
+    QCOMPARE((int)FileType::identify(file.fileName()), type);
+    QCOMPARE((int)FileType::identify(file.fileName()), type);
+}
+
+void RenamifierTest::paintPages_data()
+{
+    QTest::addColumn<int>("format");
+    QTest::addColumn<bool>("forDisplay");
+
+    // Scanned documents are often grayscale or black and white, which
+    // the renderer stores as such
+    const QList<QPair<QString, int>> formats = {
+        {"color", QImage::Format_RGB32},
+        {"grayscale", QImage::Format_Grayscale8},
+        {"monochrome", QImage::Format_Mono},
+    };
+    for (const QPair<QString, int> &format : formats) {
+        QTest::newRow(qPrintable(format.first + ", as decoded"))
+            << format.second << false;
+        QTest::newRow(qPrintable(format.first + ", for display"))
+            << format.second << true;
+    }
+}
+
+/*
+ * Measure what it costs to repaint a screenful of pages, which the viewer
+ * does every time the user scrolls, with page images as an image decoder
+ * gives them versus converted the way the renderer does.
+ *
+ * The pages are rendered from a real multi-page document, so they look
+ * like what the viewer actually paints, then reduced to the format being
+ * tested. Pages for display are converted to pixmaps once up front, the
+ * way the viewer converts pages and tiles the first time it paints them.
+ */
+void RenamifierTest::paintPages()
+{
+    QFETCH(int, format);
+    QFETCH(bool, forDisplay);
+    const int numPages = 4;
+
+    QTemporaryFile *file = renderTestFile(numPages);
+    QString errorMessage;
+    PagedContentRenderer *pagedRenderer =
+        openRenderTestFile(file, &errorMessage);
+    QVERIFY2(pagedRenderer != nullptr, qPrintable(errorMessage));
+
+    // Letter-size pages at 150 dpi. Decoders give us images with an alpha
+    // channel, like a PNG, while the renderer converts them when it's done.
+    RenderScheduler scheduler(numPages);
+    QList<QFuture<RenderResult>> futures;
+    for (int i = 0; i < numPages; i++)
+        futures.append(scheduler.request(pagedRenderer,
+                                         RenderScheduler::Visible,
+                                         RenderRequest(i, 100, 150, 150)));
+
+    QList<QImage> images;
+    QList<QPixmap> pixmaps;
+    for (int i = 0; i < numPages; i++) {
+        QImage page = futures[i].result().image;
+        QVERIFY(!page.isNull());
+        page = PagedContentRenderer::toStorageFormat(
+            page.convertToFormat((QImage::Format)format,
+                                 Qt::ThresholdDither));
+        QCOMPARE((int)page.format(), format);
+        if (forDisplay)
+            pixmaps.append(QPixmap::fromImage(page));
+        else
+            images.append(page.convertToFormat(QImage::Format_ARGB32));
+    }
+    QSize pageSize = forDisplay ? pixmaps[0].size() : images[0].size();
+
+    closeRenderTestFile(pagedRenderer, &scheduler);
+    delete file;
+
+    // Scrolled partway, so the first two pages are both visible
+    QPixmap screen(1280, 1024);
+    QPainter painter(&screen);
+    QBENCHMARK {
+        for (int i = 0; i < numPages; i++) {
+            QRect target(0, i * (pageSize.height() + 2) - 1200,
+                         pageSize.width(), pageSize.height());
+            if (!target.intersects(screen.rect()))
+                continue;
+            else if (forDisplay)
+                painter.drawPixmap(target, pixmaps[i]);
+            else
+                painter.drawImage(target, images[i]);
+        }
+    }
+}
+
+void RenamifierTest::renderScaling_data()
+{
+    QTest::addColumn<int>("threads");
+
+    int maxThreads = qMin(QThread::idealThreadCount(), 16);
+    for (int threads = 1; threads <= maxThreads; threads *= 2)
+        QTest::newRow(qPrintable(QString("%1 threads").arg(threads)))
+            << threads;
+}
+
+/*
+ * Measure how many pages per second we can render with different numbers
+ * of render threads.
+ */
+void RenamifierTest::renderScaling()
+{
+    QFETCH(int, threads);
+    const int numPages = 32;
+
+    QTemporaryFile *file = renderTestFile(numPages);
+    QString errorMessage;
+    PagedContentRenderer *pagedRenderer =
+        openRenderTestFile(file, &errorMessage);
+    QVERIFY2(pagedRenderer != nullptr, qPrintable(errorMessage));
+
+    int rendered = 0;
+    connect(pagedRenderer, &PagedContentRenderer::renderedPage,
+            this, [&rendered]() { ++rendered; }, Qt::QueuedConnection);
+
+    QList<RenderRequest> requests;
+    for (int i = 0; i < numPages; ++i)
+        requests.append(RenderRequest(i, 150));
+
+    RenderScheduler scheduler(threads);
+    QElapsedTimer timer;
+    timer.start();
+    scheduler.submit(pagedRenderer, RenderScheduler::Visible, requests);
+    QTRY_COMPARE_WITH_TIMEOUT(rendered, numPages, 60000);
+    QTest::setBenchmarkResult(numPages * 1000.0 / qMax(timer.elapsed(), 1LL),
+                              QTest::FramesPerSecond);
+
+    closeRenderTestFile(pagedRenderer, &scheduler);
+    delete file;
+}
+
+void RenamifierTest::identifyFiles_data()
+{
+    QTest::addColumn<int>("method");
+
+    QTest::newRow("QMimeDatabase") << 0;
+    QTest::newRow("sniffed") << 1;
+    QTest::newRow("cached") << 2;
+}
+
+/*
+ * Measure how long it takes to choose renderers for a queue of files,
+ * asking QMimeDatabase the way Renderer::create() used to versus sniffing
+ * them ourselves, with and without the cache.
+ */
+void RenamifierTest::identifyFiles()
+{
+    QFETCH(int, method);
+
+    // What a queue of scanned documents might hold
+    const QByteArray headers[] = {
+        QByteArray("%PDF-1.4\n%\xe2\xe3\xcf\xd3\n"),
+        QByteArray("\x89PNG\r\n\x1a\n\0\0\0\rIHDR", 16),
+        QByteArray("\xff\xd8\xff\xe0\0\x10JFIF\0", 11),
+        QByteArray("Scanned by the front desk\n"),
+    };
+    const char *suffixes[] = { "pdf", "png", "jpg", "txt" };
+
+    QTemporaryDir dir;
+    QVERIFY(dir.isValid());
+    QStringList paths;
+    for (int i = 0; i < 400; ++i) {
+        QFile file(dir.filePath(QString("%1.%2").arg(i).arg(suffixes[i % 4])));
+        QVERIFY(file.open(QIODevice::WriteOnly));
+        file.write(headers[i % 4]);
+        file.write(QByteArray(8192, (i % 4 == 3) ? 'x' : '\xa5'));
+        file.close();
+        paths.append(file.fileName());
+    }
+
+    QBENCHMARK {
+        for (int i = 0; i < paths.size(); ++i) {
+            if (method == 0) {
+                QMimeDatabase mimeDatabase;
+                FileType::fromMimeType(mimeDatabase.mimeTypeForFile(paths[i]));
+            } else if (method == 1)
+                FileType::detect(paths[i]);
+            else
+                FileType::identify(paths[i]);
+        }
+    }
+}
+
 /*
  * Add some test files.
  */
@@ -245,4 +756,122 @@ QTemporaryFile *RenamifierTest::renameTestFile()
     return tempFile;
 }
 
-QTEST_MAIN(RenamifierTest)
+/*
+ * Return the process IDs of the render workers that are running.
+ */
+QList<qint64> RenamifierTest::renderWorkerIds()
+{
+    // The pool's processes belong to its thread, so we ask them there
+    QList<qint64> ids;
+    RenderWorkerPool *pool = RenderWorkerPool::instance();
+    QMetaObject::invokeMethod(pool, [pool, &ids]() {
+        const QList<QProcess*> processes = pool->findChildren<QProcess*>();
+        for (QProcess *process : processes) {
+            if (process->state() == QProcess::Running)
+                ids.append(process->processId());
+        }
+    }, Qt::BlockingQueuedConnection);
+
+    std::sort(ids.begin(), ids.end());
+    return ids;
+}
+
+/*
+ * Kill every render worker, as if it had crashed.
+ */
+void RenamifierTest::killRenderWorkers()
+{
+    RenderWorkerPool *pool = RenderWorkerPool::instance();
+    QMetaObject::invokeMethod(pool, [pool]() {
+        const QList<QProcess*> processes = pool->findChildren<QProcess*>();
+        for (QProcess *process : processes)
+            process->kill();
+    }, Qt::BlockingQueuedConnection);
+}
+
+/*
+ * Returns a temporary PDF document for testing rendering performance.
+ * Each page is covered in enough vector shapes to take a while to render.
+ */
+QTemporaryFile *RenamifierTest::renderTestFile(int pages)
+{
+    QTemporaryFile *tempFile = new QTemporaryFile("render.XXXXXX.pdf");
+    if (!tempFile->open())
+        return tempFile;
+
+    QPdfWriter writer(tempFile);
+    writer.setPageSize(QPageSize(QPageSize::Letter));
+    writer.setResolution(72);
+
+    QPainter painter(&writer);
+    painter.setRenderHint(QPainter::Antialiasing);
+    for (int page = 0; page < pages; ++page) {
+        if (page > 0)
+            writer.newPage();
+        for (int i = 0; i < 2000; ++i) {
+            // Vary these by page so Poppler can't reuse anything
+            int x = (i * 37 + page * 11) % 612, y = (i * 53 + page * 7) % 792;
+            painter.setPen(QColor::fromHsv((i + page) % 360, 255, 200));
+            painter.drawEllipse(QPoint(x, y), i % 50 + 5, i % 30 + 5);
+        }
+    }
+    painter.end();
+
+    tempFile->close();
+    return tempFile;
+}
+
+/*
+ * Open a file made by renderTestFile(), in a render worker if isolated is
+ * true. Returns null and explains why in errorMessage if it can't.
+ */
+PagedContentRenderer *RenamifierTest::openRenderTestFile(
+    QTemporaryFile *file, QString *errorMessage, bool isolated)
+{
+    QSettings settings;
+    if (isolated)
+        settings.setValue("render/isolated", true);
+    Renderer *renderer = Renderer::create(file->fileName(), errorMessage);
+    settings.remove("render/isolated");
+
+    if (renderer != nullptr && renderer->mode() != Renderer::PagedContent) {
+        *errorMessage = "The test file isn't a paged document";
+        delete renderer;
+        return nullptr;
+    }
+    return (PagedContentRenderer*)renderer;
+}
+
+/*
+ * Delete a renderer from openRenderTestFile() once the test's scheduler
+ * is done with it. It looks up its page sizes on the main scheduler, so
+ * that has to be done with it too.
+ */
+void RenamifierTest::closeRenderTestFile(PagedContentRenderer *renderer,
+                                         RenderScheduler *scheduler)
+{
+    scheduler->finish(renderer);
+    RenderScheduler::instance()->finish(renderer);
+    delete renderer;
+}
+
+/*
+ * The render worker tests start copies of this program to render in,
+ * so like the application, it has to know when it's one of those.
+ */
+int main(int argc, char **argv)
+{
+    if (argc > 1 && std::strcmp(argv[1], RENDER_WORKER_OPTION) == 0) {
+        qputenv("QT_QPA_PLATFORM", "offscreen");
+        QGuiApplication app(argc, argv);
+        Renderer::init();
+        RenderWorker worker(app.arguments());
+        return worker.exec();
+    }
+
+    QApplication app(argc, argv);
+    app.setAttribute(Qt::AA_Use96Dpi, true);
+    RenamifierTest test;
+    QTEST_SET_MAIN_SOURCE_PATH
+    return QTest::qExec(&test, argc, argv);
+}
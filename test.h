@@ -21,14 +21,22 @@
 #define RENAMIFIER_TEST_H
 
 #include <QObject>
+#include <QList>
 #include <QString>
 #include <QStringList>
+#include <QTemporaryDir>
 #include <QTemporaryFile>
+#include <QPainter>
+#include <QPdfWriter>
+#include <QPixmap>
 
 #include <QtTest>
 
 #include "main_window.h"
 
+class PagedContentRenderer;
+class RenderScheduler;
+
 class RenamifierTest : public QObject
 {
     Q_OBJECT
@@ -48,6 +56,7 @@ private slots:
     void renameWorks();
 
     // Tests for correct UI behavior
+    void displayFileIsAsynchronous();
     void displayFileWraps();
     void renameWithNoNameEntered();
 
@@ -56,11 +65,36 @@ private slots:
     void renameWithNothingOpen();
     void renameAndMoveWithNothingOpen();
 
+    // Tests for rendering
+    void storageFormats();
+    void pageCacheMisses();
+    void requestPages();
+    void requestText();
+    void renderWorkers();
+    void fileTypes_data();
+    void fileTypes();
+
+    // Benchmarks
+    void paintPages_data();
+    void paintPages();
+    void renderScaling_data();
+    void renderScaling();
+    void identifyFiles_data();
+    void identifyFiles();
+
 private:
     void addTestFiles();
     void confirmThatNothingIsOpen();
     void confirmThatFileIsDisplayed(int index);
     QTemporaryFile *renameTestFile();
+    QTemporaryFile *renderTestFile(int pages);
+    PagedContentRenderer *openRenderTestFile(QTemporaryFile *file,
+                                             QString *errorMessage,
+                                             bool isolated = false);
+    void closeRenderTestFile(PagedContentRenderer *renderer,
+                             RenderScheduler *scheduler);
+    QList<qint64> renderWorkerIds();
+    void killRenderWorkers();
 };
 
 #endif /* RENAMIFIFER_TEST_H */
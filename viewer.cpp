@@ -26,6 +26,9 @@
 #include "viewer_text.h"
 #include "viewer_paged.h"
 #include "renderer.h"
+#include "renderer_cache.h"
+#include "render_scheduler.h"
+#include "preview_cache.h"
 
 /* ------------------------------------------------------------------------ */
 
@@ -41,6 +44,11 @@
 // Units above are multiplied by a factor of 10 to allow use of integer math.
 #define INITIAL_FACTOR 10
 
+// Wait this long in milliseconds before showing the loading message.
+// Most files load faster than this, and it's less distracting not to
+// flash the message on screen for a split second each time.
+#define LOADING_DELAY 150
+
 /* ------------------------------------------------------------------------ */
 
 Viewer::Viewer(QWidget *parent)
@@ -49,15 +57,46 @@ Viewer::Viewer(QWidget *parent)
     textContentViewer = new TextContentViewer(this);
     addWidget(textContentViewer);
 
+    renderer = nullptr;
+    renderThread = new QThread(this);
+    renderThread->start();
+
+    // This has threads of its own to render pages on
+    renderScheduler = new RenderScheduler(0, this);
+
     pagedContentScrollArea = new ViewerScrollArea(this);
     addWidget(pagedContentScrollArea);
 
-    pagedContent = new PagedContent(pagedContentScrollArea);
+    pagedContent = new PagedContent(renderScheduler, pagedContentScrollArea);
     pagedContentScrollArea->setWidget(pagedContent);
-
-    renderer = nullptr;
-    renderThread = new QThread(this);
-    renderThread->start();
+    // Prefetch at the new zoom level once the user settles on one
+    connect(pagedContent, &PagedContent::zoomSettled,
+            this, &Viewer::updateRenderParameters);
+
+    loadingLabel = new QLabel("Loading...", this);
+    loadingLabel->setAlignment(Qt::AlignCenter);
+    loadingLabel->setBackgroundRole(QPalette::Dark);
+    loadingLabel->setAutoFillBackground(true);
+    addWidget(loadingLabel);
+
+    previewLabel = new QLabel(this);
+    previewLabel->setAlignment(Qt::AlignTop | Qt::AlignHCenter);
+    previewLabel->setBackgroundRole(QPalette::Dark);
+    previewLabel->setAutoFillBackground(true);
+    addWidget(previewLabel);
+    previewCache = new PreviewCache;
+
+    rendererCache = new RendererCache(renderThread, renderScheduler, this);
+    connect(rendererCache, &RendererCache::ready,
+            this, &Viewer::rendererReady);
+    connect(rendererCache, &RendererCache::loadFailed,
+            this, &Viewer::rendererLoadFailed);
+
+    loading = false;
+    displayWhenLoaded = false;
+    loadingTimer = new QTimer(this);
+    loadingTimer->setSingleShot(true);
+    connect(loadingTimer, &QTimer::timeout, this, &Viewer::showLoading);
 
     zoomFactor = 100;
     connect(textContentViewer, &TextContentViewer::wheelZoomed,
@@ -69,6 +108,11 @@ Viewer::Viewer(QWidget *parent)
 Viewer::~Viewer()
 {
     unloadRenderer();
+    // This deletes renderers on the render thread, so it has to go first
+    delete rendererCache;
+    delete previewCache;
+    // Likewise, this passes renderers it's finished with back to it
+    delete renderScheduler;
     if (renderThread != nullptr) {
         renderThread->quit();
         renderThread->wait();
@@ -77,59 +121,110 @@ Viewer::~Viewer()
 
 /*
  * Load and display the specified file.
+ *
+ * This returns immediately; the file is displayed once it has loaded.
  */
 void Viewer::display(const QString &path)
 {
     clear();
     load(path);
+    if (isLoading())
+        showPreview();
     refresh();
 }
 
 /*
- * Create and connect a renderer for the specified file,
+ * Start creating a renderer for the specified file,
  * but do not immediately display it.
+ *
+ * If the file was prefetched, its renderer is connected right away.
+ * Otherwise it's created in the background; rendererReady() connects it
+ * once it's ready, or rendererLoadFailed() displays an error if not.
  */
 void Viewer::load(const QString &path)
 {
-    QString loadError;
     unloadRenderer();
 
     path_ = path;
-    renderer = Renderer::create(path_, &loadError);
-    if (renderer == nullptr) {
-        // An error occurred while loading the file
-        displayError(loadError);
-        return;
-    }
-
-    renderer->moveToThread(renderThread);
+    loading = true;
+    rendererReady(path_);
+}
 
-    connect(renderer, &Renderer::errorEncountered,
-            this, &Viewer::displayError);
+/*
+ * Load and display the specified file from scratch, even if we already
+ * have it loaded.
+ */
+void Viewer::reload(const QString &path)
+{
+    if (path == path_)
+        discardRenderer();
+    unloadRenderer();
+    rendererCache->forget(path);
+    display(path);
+}
 
-    // These will reject one another's Renderers, so no need to overthink this
-    textContentViewer->setRenderer(renderer);
-    pagedContent->setRenderer(renderer);
+/*
+ * Get a head start on loading files the user is likely to view next.
+ *
+ * This replaces the previous list, so pass an empty list to stop.
+ */
+void Viewer::prefetch(const QStringList &paths)
+{
+    updateRenderParameters();
+    rendererCache->prefetch(paths);
 }
 
 /*
- * Disconnect and delete the current renderer.
+ * Disconnect the current renderer.
+ *
+ * The renderer is kept for a while in case the user comes back to this
+ * file. This also cancels any load in progress.
  */
 void Viewer::unloadRenderer()
 {
+    if (loading) {
+        rendererCache->release(path_);
+        loading = false;
+    }
+
+    // Save these before the paged content viewer throws them out
+    PageImages pages = pagedContent->pageImages();
+    if (pages.contains(0))
+        previewCache->store(path_, renderParameters(), pages.value(0));
+
     path_.clear();
+    preview = QImage();
+    previewLabel->clear();
     textContentViewer->setRenderer(nullptr);
     pagedContent->setRenderer(nullptr);
+    displayWhenLoaded = false;
+    loadingTimer->stop();
 
     if (renderer != nullptr) {
         // Don't respond to any more signals from this Renderer
         disconnect(renderer, nullptr, nullptr, nullptr);
-        // Qt gets upset and segfaults if we delete this directly
-        renderer->deleteLater();
+        rendererCache->retain(renderer, pages);
         renderer = nullptr;
     }
 }
 
+/*
+ * Make sure we're not holding the specified file open so it can be renamed.
+ * Call unloadRenderer() first if it's the file currently displayed.
+ */
+void Viewer::releaseFile(const QString &path)
+{
+    rendererCache->releaseFile(path);
+}
+
+/*
+ * Keep what we've rendered for a file under its new name.
+ */
+void Viewer::fileRenamed(const QString &oldPath, const QString &newPath)
+{
+    rendererCache->fileRenamed(oldPath, newPath);
+}
+
 void Viewer::setFocusPolicy(Qt::FocusPolicy policy)
 {
     textContentViewer->setFocusPolicy(policy);
@@ -154,8 +249,15 @@ void Viewer::clear()
  */
 void Viewer::refresh()
 {
-    if (renderer == nullptr)
+    if (renderer == nullptr) {
+        if (isLoading() && !displayWhenLoaded) {
+            // We'll get back to this in rendererReady()
+            displayWhenLoaded = true;
+            if (preview.isNull())
+                loadingTimer->start(LOADING_DELAY);
+        }
         return;
+    }
 
     // Do not clear() here! The entire _point_ is that we do not clear() here.
     // (We don't want its side effects like changing the scrollbar position)
@@ -190,7 +292,9 @@ void Viewer::displayError(const QString &details)
     QTextStream textStream(&message);
     QString path = path_;   // save this before unloadRenderer() clears it
 
-    // Stop rendering immediately; we'll do other cleanup later
+    // Stop rendering immediately; we'll do other cleanup later.
+    // Don't keep this renderer around since it's clearly having problems.
+    discardRenderer();
     unloadRenderer();
 
     // Tell the user what happened
@@ -209,6 +313,140 @@ void Viewer::displayError(const QString &details)
     textContentViewer->setPlainText(message);
 }
 
+/*
+ * Connect the renderer for the file we're loading if it's ready.
+ */
+void Viewer::rendererReady(const QString &path)
+{
+    if (!(loading && path == path_))
+        return;     // the user has already moved on to something else
+
+    PageImages pages;
+    Renderer *loaded = rendererCache->take(path_, &pages);
+    if (loaded != nullptr) {
+        loading = false;
+        loadingTimer->stop();
+
+        // The preview is as good as the real thing, and it saves us
+        // rendering the first page again
+        if (!(preview.isNull() || pages.contains(0)))
+            pages.insert(0, preview);
+        preview = QImage();
+        previewLabel->clear();
+        connectRenderer(loaded, pages);
+
+        if (displayWhenLoaded) {
+            displayWhenLoaded = false;
+            refresh();
+        }
+    }
+}
+
+void Viewer::rendererLoadFailed(const QString &path, const QString &details)
+{
+    if (loading && path == path_)
+        displayError(details);
+}
+
+/*
+ * Let the user know we're still working on it.
+ */
+void Viewer::showLoading()
+{
+    if (isLoading())
+        setCurrentWidget(loadingLabel);
+}
+
+/*
+ * Connect a renderer, along with any pages it has already rendered.
+ */
+void Viewer::connectRenderer(Renderer *loaded, const PageImages &pages)
+{
+    renderer = loaded;
+    connect(renderer, &Renderer::errorEncountered,
+            this, &Viewer::displayError);
+
+    // These will reject one another's Renderers, so no need to overthink this
+    textContentViewer->setRenderer(renderer);
+    pagedContent->setRenderer(renderer);
+
+    PageImages::const_iterator i;
+    for (i = pages.constBegin(); i != pages.constEnd(); ++i)
+        pagedContent->setPageImage(i.key(), i.value());
+}
+
+/*
+ * Delete the current renderer rather than keeping it for later.
+ */
+void Viewer::discardRenderer()
+{
+    if (renderer != nullptr) {
+        textContentViewer->setRenderer(nullptr);
+        pagedContent->setRenderer(nullptr);
+
+        disconnect(renderer, nullptr, nullptr, nullptr);
+        // Qt gets upset and segfaults if we delete this directly,
+        // and the scheduler may still be rendering a page for it
+        if (renderer->mode() == Renderer::PagedContent)
+            renderScheduler->dispose((PagedContentRenderer*)renderer);
+        else
+            renderer->deleteLater();
+        renderer = nullptr;
+    }
+}
+
+/*
+ * Describe how we're currently displaying pages.
+ */
+RenderParameters Viewer::renderParameters() const
+{
+    RenderParameters parameters;
+    parameters.zoomFactor = zoomFactor;
+    parameters.dpiX = pagedContent->logicalDpiX();
+    parameters.dpiY = pagedContent->logicalDpiY();
+    parameters.devicePixelRatio = pagedContent->devicePixelRatio();
+    parameters.viewportSize = pagedContentScrollArea->viewport()->size();
+    return parameters;
+}
+
+/*
+ * Show the first page from the preview cache while the file loads,
+ * if we have it.
+ */
+void Viewer::showPreview()
+{
+    QFuture<QImage> found = previewCache->find(path_, renderParameters());
+    if (found.isFinished()) {
+        showPreview(path_, found.result());
+        return;
+    }
+
+    // It may be a while, so don't hold up the rest of the display
+    QString path = path_;
+    found.then(this, [this, path](const QImage &image) {
+        showPreview(path, image);
+    });
+}
+
+void Viewer::showPreview(const QString &path, const QImage &image)
+{
+    if (image.isNull() || !(loading && path == path_))
+        return;     // too late, or nothing to show
+
+    preview = image;
+    loadingTimer->stop();
+    previewLabel->setPixmap(QPixmap::fromImage(preview));
+    setCurrentWidget(previewLabel);
+}
+
+/*
+ * Tell the prefetcher how we're currently displaying pages.
+ */
+void Viewer::updateRenderParameters()
+{
+    rendererCache->setRenderParameters(renderParameters());
+}
+
 /*
  * Default to the paged content viewer's preferred size.
  */
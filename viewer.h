@@ -21,12 +21,17 @@
 #define VIEWER_H
 
 #include <QObject>
+#include <QImage>
+#include <QMap>
 #include <QPoint>
 #include <QSize>
+#include <QStringList>
 #include <QThread>
 
+#include <QLabel>
 #include <QStackedWidget>
 #include <QScrollArea>
+#include <QTimer>
 #include <QResizeEvent>
 #include <QWheelEvent>
 
@@ -38,6 +43,10 @@ class ViewerScrollArea;
 class TextContentViewer;
 class PagedContent;
 class Renderer;
+class RendererCache;
+class RenderScheduler;
+class PreviewCache;
+struct RenderParameters;
 
 /*
  * File preview widget.
@@ -55,8 +64,15 @@ public:
 
     void display(const QString &path);
     void load(const QString &path);
+    void reload(const QString &path);
+    void prefetch(const QStringList &paths);
     void unloadRenderer();
 
+    void releaseFile(const QString &path);
+    void fileRenamed(const QString &oldPath, const QString &newPath);
+
+    inline bool isLoading() const { return loading; }
+
     void setFocusPolicy(Qt::FocusPolicy policy);
 
     QSize sizeHint() const;
@@ -71,7 +87,28 @@ public slots:
     inline void zoomOut(int range=1) { setZoom(zoomFactor - 10 * range); }
 
 private:
+    void connectRenderer(Renderer *loaded, const QMap<int, QImage> &pages);
+    void discardRenderer();
+    RenderParameters renderParameters() const;
+    void showPreview();
+    void showPreview(const QString &path, const QImage &image);
+
+    // Renderers belong to this thread once they're loaded, and are deleted
+    // here. Text files are also read here. Anything that could keep it busy
+    // for long runs on the scheduler's threads instead, so it's always free
+    // to close a file before renaming it.
     QThread *renderThread;
+    // Everything on the render thread shares it through this
+    RenderScheduler *renderScheduler;
+    // Renderers are created in the background so loading a large file
+    // doesn't freeze the user interface
+    RendererCache *rendererCache;
+    bool loading;
+    bool displayWhenLoaded;
+    QTimer *loadingTimer;
+    // First pages saved from earlier sessions, to show while loading
+    PreviewCache *previewCache;
+    QImage preview;
     // The Viewer class creates and owns the renderer, but the individual
     // widgets below handle most of the interaction with it
     Renderer *renderer;
@@ -79,11 +116,17 @@ private:
     TextContentViewer *textContentViewer;
     ViewerScrollArea *pagedContentScrollArea;
     PagedContent *pagedContent;
+    QLabel *loadingLabel;
+    QLabel *previewLabel;
     QString path_;
     int zoomFactor;
 
 private slots:
     void displayError(const QString &details);
+    void rendererReady(const QString &path);
+    void rendererLoadFailed(const QString &path, const QString &details);
+    void showLoading();
+    void updateRenderParameters();
 
 signals:
     void zoomChanged(int percent);
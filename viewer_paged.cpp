@@ -17,55 +17,172 @@
  * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
  */
 
-#include <algorithm>    // for std::max()
+#include <algorithm>    // for std::min(), std::max(), std::clamp(), etc.
 
 #include <QtCore>
 #include <QtWidgets>
 
 #include "viewer_paged.h"
 #include "renderer.h"
+#include "render_scheduler.h"
 
 /* ------------------------------------------------------------------------ */
 
 // Margin in pixels for graphical content
 #define PAGE_MARGIN 2
 
+// Number of pages past the visible ones to render in the scroll direction,
+// depending on how fast the user is scrolling
+#define MIN_ADJACENT_PAGES 1
+#define MAX_ADJACENT_PAGES 8
+
+// How far ahead to render while scrolling, in milliseconds of scrolling at
+// the current speed. This should cover at least a typical page render.
+#define LOOKAHEAD_TIME 1000
+
+// Stop rendering while scrolling faster than this many screenfuls per
+// second, since pages won't be visible long enough to be worth it
+#define FAST_SCROLL_SPEED 4
+
+// Scroll steps further apart than this in milliseconds are separate
+// gestures, so we don't count the time between them toward the speed
+#define SCROLL_GESTURE_GAP 200
+
+// Start rendering the rest of the document after this many milliseconds
+// without scrolling or zooming
+#define IDLE_DELAY 500
+
+// Percentage of the page cache that can be filled by rendering pages
+// nobody has asked for yet
+#define IDLE_CACHE_SHARE 50
+
+// Show a quick draft first if a page takes longer than this to render (ms)
+#define DRAFT_THRESHOLD 50
+
+// Wait this long in milliseconds after the last zoom step before rendering
+// at the new zoom level. Until then, we scale what we already have.
+#define ZOOM_SETTLE_DELAY 250
+
 /* ------------------------------------------------------------------------ */
 
-struct Page {
-    Page();
-    inline QRect rect() const { return QRect(x, y, width, height); }
+PageGeometry::PageGeometry()
+{
+    isTiled = false;
+    width = height = 0;
+}
 
-    QImage image;
-    int x;
-    int y;
-    int width;
-    int height;
-    bool isRendering;
-};
+PageGeometry::PageGeometry(const QSize &pixelSize, qreal dpRatio)
+{
+    this->pixelSize = pixelSize;
+    isTiled = PagedContentRenderer::isTiled(pixelSize);
+
+    // The renderer does not understand Qt's high-DPI handling
+    // (something it and I have in common), so we need to manually
+    // scale this back to the correct logical size
+    QSize size = pixelSize / dpRatio;
+    width = size.width();
+    height = size.height();
+}
+
+int PageGeometry::tileColumns() const
+{
+    return (pixelSize.width() + TILE_SIZE - 1) / TILE_SIZE;
+}
+
+/*
+ * Return the area covered by a tile, in physical pixels relative to the
+ * top-left corner of the page. Tiles on the right and bottom edges may be
+ * smaller than TILE_SIZE.
+ */
+QRect PageGeometry::tileRect(int index) const
+{
+    int columns = tileColumns();
+    QRect rect((index % columns) * TILE_SIZE, (index / columns) * TILE_SIZE,
+               TILE_SIZE, TILE_SIZE);
+    return rect.intersected(QRect(QPoint(0, 0), pixelSize));
+}
+
+/* ------------------------------------------------------------------------ */
 
 Page::Page()
 {
-    x = y = -1;
-    width = height = 0;
-    isRendering = false;
+    isDraft = false;
+    isPartial = false;
+    pixmapSource = 0;
+}
+
+/*
+ * Return the image as a pixmap for painting.
+ *
+ * Color images are already in a format that doesn't need converting, so
+ * on most platforms the pixmap just shares their data. Grayscale and
+ * monochrome images are expanded here, once, and only for pages we're
+ * actually painting; everything else stays in its compact form.
+ */
+const QPixmap &Page::pixmap()
+{
+    if (pixmap_.isNull() || pixmapSource != image.cacheKey()) {
+        pixmap_ = QPixmap::fromImage(image);
+        pixmapSource = image.cacheKey();
+    }
+    return pixmap_;
+}
+
+/*
+ * Return a tile as a pixmap for painting, made the same way as pixmap().
+ */
+const QPixmap &Page::tilePixmap(int index)
+{
+    const QImage &tile = tiles[index];
+    TilePixmap &tilePixmap = tilePixmaps[index];
+    if (tilePixmap.pixmap.isNull() || tilePixmap.source != tile.cacheKey()) {
+        tilePixmap.pixmap = QPixmap::fromImage(tile);
+        tilePixmap.source = tile.cacheKey();
+    }
+    return tilePixmap.pixmap;
+}
+
+/*
+ * Let go of the pixmaps of tiles we don't have anymore.
+ */
+void Page::releaseTilePixmaps()
+{
+    tilePixmaps.removeIf([this](const QMap<int, TilePixmap>::iterator &i) {
+        return !tiles.contains(i.key());
+    });
 }
 
 /* ------------------------------------------------------------------------ */
 
-PagedContent::PagedContent(QScrollArea *parent)
+PagedContent::PagedContent(RenderScheduler *scheduler, QScrollArea *parent)
     : QWidget(parent)
 {
     renderer = nullptr;
+    this->scheduler = scheduler;
     viewport = parent->viewport();
 
+    contentWidth = 0;
+    firstVisible = 0, lastVisible = -1;
+    firstWanted = 0, lastWanted = -1;
+    firstHeld = 0, lastHeld = -1;
+    scrollDirection = 1;
+    storedBytesPerPixel = 0;
+    scrollSpeed = 0;
+    moveClock.start();
+
     zoomFactor = 100;
-    purgeInvisible = true;  // purge invisible pages to save memory?
 
     isMoving = false;
+    isZooming = false;
+    zoomTimer = new QTimer(this);
+    zoomTimer->setSingleShot(true);
+    connect(zoomTimer, &QTimer::timeout, this, &PagedContent::stoppedZooming);
     moveTimer = new QTimer(this);
     moveTimer->setSingleShot(true);
     connect(moveTimer, &QTimer::timeout, this, &PagedContent::stoppedMoving);
+    idleTimer = new QTimer(this);
+    idleTimer->setSingleShot(true);
+    connect(idleTimer, &QTimer::timeout, this, &PagedContent::renderRest);
 
     // Never shrink smaller than the content
     setSizePolicy(QSizePolicy::Minimum, QSizePolicy::Minimum);
@@ -82,20 +199,31 @@ void PagedContent::setRenderer(Renderer *replacement)
     if (!pages.isEmpty())
         purgeCache();
 
+    // The old renderer may still be around, so make sure it doesn't keep
+    // working on pages we no longer want
+    if (renderer != nullptr) {
+        scheduler->cancel(renderer);
+        disconnect(renderer, nullptr, this, nullptr);
+        pageCache.removeRenderer(renderer);
+    }
+    pageCache.loadSettings();
+
     if (replacement != nullptr
         && replacement->mode() == Renderer::PagedContent) {
         renderer = (PagedContentRenderer*)replacement;
 
         // Prepare the cache
-        int numPages = renderer->numPages();
-        pages.reserve(numPages);
-        for (int i = 0; i < numPages; i++)
-            pages.append(new Page);
+        pages.resize(renderer->numPages());
+        storedBytesPerPixel = 0;
 
-        connect(this, &PagedContent::imageRequested,
-                renderer, &PagedContentRenderer::renderPage);
         connect(renderer, &PagedContentRenderer::renderedPage,
-                this, &PagedContent::setPageImage);
+                this, &PagedContent::pageRendered);
+        connect(renderer, &PagedContentRenderer::renderedPartialPage,
+                this, &PagedContent::pagePartiallyRendered);
+        connect(renderer, &PagedContentRenderer::pageSizesChanged,
+                this, &PagedContent::pageSizesChanged);
+        connect(renderer, &PagedContentRenderer::pagesChanged,
+                this, &PagedContent::pagesChanged);
     } else
         renderer = nullptr;
 }
@@ -103,35 +231,128 @@ void PagedContent::setRenderer(Renderer *replacement)
 void PagedContent::setZoomFactor(int percent)
 {
     zoomFactor = percent;
+    int firstMoved = 0;
 
     if (renderer != nullptr) {
+        // Keep existing images if nothing has changed, like when displaying
+        // pages rendered in advance
+        bool changed = (renderer->zoomFactor() != percent
+                        || renderer->dpiX() != logicalDpiX()
+                        || renderer->dpiY() != logicalDpiY());
+
+        // Keep the old images in case the user zooms back.
+        // This has to happen before we change the renderer's settings,
+        // since they're part of the cache key.
+        bool hasPlaceholders = false;
+        if (changed) {
+            for (int i = firstHeld; i <= lastHeld; i++) {
+                Page *page = &pages[i];
+                QImage placeholder = page->image;
+                stashImages(i, true);
+
+                // Meanwhile, scale the old image to stand in for the new one
+                if (!placeholder.isNull()) {
+                    page->image = placeholder;
+                    page->isDraft = true;
+                    page->isPartial = false;
+                    hasPlaceholders = true;
+                }
+            }
+        }
+
+        // Hold off rendering until the user stops zooming, so we don't
+        // waste time on zoom levels they're only passing through
+        if (hasPlaceholders) {
+            isZooming = true;
+            zoomTimer->start(ZOOM_SETTLE_DELAY);
+        }
+
         renderer->setZoomFactor(percent);
         // Render at the correct physical size on high-DPI screens
         renderer->setPixelDensity(logicalDpiX(), logicalDpiY());
         qreal dpRatio = devicePixelRatio();
 
-        for (int i = 0; i < pages.count(); i++) {
-            Page *page = pages[i];
-            // The renderer does not understand Qt's high-DPI handling
-            // (something it and I have in common), so we need to manually
-            // scale this back to the correct logical size
-            QSize size = renderer->pageSize(i) / dpRatio;
+        // If the pages are all the same size, the first one tells us
+        // everything, and zooming takes no longer on a long document
+        QList<PageGeometry> sizes;
+        PageGeometry uniform;
+        if (!pages.isEmpty() && renderer->hasUniformPageSizes()) {
+            uniform = PageGeometry(renderer->pageSize(0), dpRatio);
+            contentWidth = uniform.width;
+        } else {
+            sizes.reserve(pages.count());
+            contentWidth = 0;
+            for (int i = 0; i < pages.count(); i++) {
+                sizes.append(PageGeometry(renderer->pageSize(i), dpRatio));
+                contentWidth = std::max(contentWidth, sizes[i].width);
+            }
+        }
 
-            page->width = size.width();
-            page->height = size.height();
+        // Only pages we're holding have images that might need fixing
+        for (int i = firstHeld; i <= lastHeld; i++) {
+            Page *page = &pages[i];
+            const PageGeometry &size = sizes.isEmpty() ? uniform : sizes[i];
+            const QSize &oldSize = geometry(i).pixelSize;
+            if (!changed && size.pixelSize != oldSize && !oldSize.isEmpty()) {
+                // The renderer got this page's size wrong the first time,
+                // so anything we have for it is the wrong shape
+                page->image = QImage();
+                page->isDraft = false;
+                page->releasePixmap();
+                page->tiles.clear();
+                page->releaseTilePixmaps();
+            }
+
+            // Whole images of tiled pages only serve as placeholders
+            // until the tiles arrive
+            if (size.isTiled && !page->image.isNull())
+                page->isDraft = true;
+        }
 
-            // Purge the old image so we're forced to re-render
-            page->image = QImage();
+        // Pages before the first one to change height stay where they are
+        if (!pageTops.isEmpty()) {
+            while (firstMoved < sizes.count()
+                   && sizes[firstMoved].height == pageSizes[firstMoved].height)
+                firstMoved++;
         }
+        pageSizes.swap(sizes);
+        uniformSize = uniform;
     }
 
+    setPagePositions(firstMoved);
     fitToContent();
-    setPagePositions();
+
+    if (!isZooming)
+        emit zoomSettled();
+}
+
+/*
+ * Return the page images we currently have.
+ */
+QMap<int, QImage> PagedContent::pageImages() const
+{
+    QMap<int, QImage> images;
+    for (int i = firstHeld; i <= lastHeld; i++) {
+        if (!(pages[i].image.isNull() || pages[i].isDraft))
+            images.insert(i, pages[i].image);
+    }
+    return images;
+}
+
+/*
+ * Return the area a page occupies in this widget.
+ */
+QRect PagedContent::pageRect(int num) const
+{
+    const PageGeometry &size = geometry(num);
+    // Center the page if the visible area is wider
+    return QRect(std::max(0, (viewport->width() - size.width) / 2),
+                 pageTop(num), size.width, size.height);
 }
 
 void PagedContent::clear()
 {
-    visiblePages.clear();
+    firstVisible = 0, lastVisible = -1;
     update();
 }
 
@@ -146,26 +367,106 @@ void PagedContent::display()
  */
 void PagedContent::refresh()
 {
-    visiblePages.clear();
-    visiblePages.reserve(2);    // this doesn't have to be exact
-
+    QList<RenderRequest> draftRequests, visibleRequests, adjacentRequests;
     QRect visibleArea = visibleRect();
-    for (int i = 0; i < pages.count(); i++) {
-        Page *page = pages[i];
-
-        if (page->rect().intersects(visibleArea)) {
-            if (page->image.isNull()
-                && (!(isMoving || page->isRendering))) {
-                // Request an image from the renderer
-                // setPageImage() will paint it when it comes back
-                page->isRendering = true;
-                emit imageRequested(i);
+    // Don't render anything we may not need by the time it's ready
+    bool holdRequests = isZooming
+        || (isMoving
+            && scrollSpeed > FAST_SCROLL_SPEED * visibleArea.height());
+
+    // Let requestTiles() decide these from scratch
+    for (int i = firstWanted; i <= lastWanted && i < pages.count(); i++)
+        pages[i].wantedTiles.clear();
+
+    // Pages are laid out top to bottom, so only those between the first
+    // one to reach the top of the visible area and the last one to start
+    // above its bottom can be visible
+    firstVisible = pageAt(visibleArea.top());
+    lastVisible = lastPageAbove(visibleArea.bottom());
+
+    for (int i = firstVisible; i <= lastVisible; i++) {
+        Page *page = &pages[i];
+
+        if (pageRect(i).intersects(visibleArea)) {
+            if (geometry(i).isTiled)
+                requestTiles(i, visibleArea,
+                             holdRequests ? nullptr : &visibleRequests);
+            else {
+                if (page->image.isNull() || page->isDraft)
+                    restoreImage(i, -1);    // cheaper than rendering it
+                if ((page->image.isNull() || page->isDraft)
+                    && !holdRequests) {
+                    // Show something quickly if the real thing will take
+                    // a while
+                    if (page->image.isNull() && wantsDraft(i))
+                        draftRequests.append(requestFor(i, QRect(), true));
+                    // pageRendered() will paint it when it comes back
+                    visibleRequests.append(requestFor(i));
+                }
             }
-            visiblePages.append(pages.at(i));
-        } else if (purgeInvisible)
-            page->image = QImage(); // tantamount to deletion
-        else if (page->y > visibleArea.bottom())
-            break;  // the remaining pages are outside our visible area
+        }
+    }
+
+    if (firstVisible > lastVisible)
+        firstWanted = 0, lastWanted = -1;
+    else {
+        firstWanted = firstVisible, lastWanted = lastVisible;
+
+        // Get a head start on the pages the user is scrolling toward,
+        // looking further ahead the faster they go
+        int lookahead = visibleArea.height()
+                        + scrollSpeed * LOOKAHEAD_TIME / 1000;
+        int adjacentPages = (scrollDirection > 0)
+            ? pageAt(visibleArea.bottom() + lookahead) - lastVisible
+            : firstVisible - pageAt(visibleArea.top() - lookahead);
+        adjacentPages = std::clamp(adjacentPages,
+                                   MIN_ADJACENT_PAGES, MAX_ADJACENT_PAGES);
+
+        for (int n = 1; n <= adjacentPages; n++) {
+            int i = (scrollDirection > 0) ? lastVisible + n : firstVisible - n;
+            if (i < 0 || i >= pages.count())
+                break;
+
+            firstWanted = std::min(firstWanted, i);
+            lastWanted = std::max(lastWanted, i);
+            if (geometry(i).isTiled) {
+                // Only the part that will be visible after one more screenful
+                QRect nextArea = visibleArea.translated(
+                    0, scrollDirection * visibleArea.height());
+                requestTiles(i, nextArea,
+                             holdRequests ? nullptr : &adjacentRequests);
+            } else {
+                if (pages[i].image.isNull() || pages[i].isDraft)
+                    restoreImage(i, -1);
+                if ((pages[i].image.isNull() || pages[i].isDraft)
+                    && !holdRequests)
+                    adjacentRequests.append(requestFor(i));
+            }
+        }
+    }
+
+    // Anything we don't need right now goes to the page cache, which
+    // keeps the total memory use in check
+    for (int i = firstHeld; i <= lastHeld; i++)
+        stashImages(i, false);
+    firstHeld = firstWanted, lastHeld = lastWanted;
+
+    // These replace whatever we asked for last time, so pages that have
+    // scrolled out of view since then won't be rendered
+    if (renderer != nullptr) {
+        // All the drafts go first, so the user has something to look at
+        // while the rest are rendered
+        scheduler->submit(renderer, RenderScheduler::Visible,
+                          draftRequests + visibleRequests);
+        scheduler->submit(renderer, RenderScheduler::Adjacent,
+                          adjacentRequests);
+
+        // Stop rendering the rest of the document until things settle down,
+        // since it may no longer be what we want
+        scheduler->submit(renderer, RenderScheduler::Background,
+                          QList<RenderRequest>());
+        if (!(isMoving || isZooming))
+            idleTimer->start(IDLE_DELAY);
     }
 
     update();
@@ -176,10 +477,24 @@ void PagedContent::moveEvent(QMoveEvent *event)
     if (updatesEnabled()) {
         event->accept();
 
-        // Refresh once immediately so the user can see the new content, but
-        // delay further renders until we've stopped moving.
-        // This avoids rendering pages that aren't visible for any meaningful
-        // amount of time when rapidly scrolling.
+        // Content moving up means the user is scrolling down
+        int dy = event->pos().y() - event->oldPos().y();
+        if (dy != 0)
+            scrollDirection = (dy < 0) ? 1 : -1;
+
+        // Keep a running average so one big step doesn't throw it off
+        qint64 elapsed = moveClock.restart();
+        if (!isMoving || elapsed > SCROLL_GESTURE_GAP)
+            scrollSpeed = 0;    // this is the start of a new gesture
+        else if (elapsed > 0) {
+            qreal speed = qAbs(dy) * 1000.0 / elapsed;
+            scrollSpeed = (scrollSpeed == 0) ? speed
+                                             : (3 * scrollSpeed + speed) / 4;
+        }
+
+        // Refresh immediately so the user can see the new content, though
+        // refresh() holds off on rendering if we're moving too fast for
+        // pages to be visible for any meaningful amount of time
         refresh();
         isMoving = true;
         moveTimer->start(50);
@@ -193,54 +508,56 @@ void PagedContent::paintEvent(QPaintEvent *event)
         event->accept();
 
         QPainter painter(this);
-        for (int i = 0; i < visiblePages.count(); i++) {
-            const Page *page = visiblePages.at(i);
-            QRect pageRect = page->rect();
+        for (int i = firstVisible; i <= lastVisible; i++) {
+            Page *page = &pages[i];
+            QRect pageRect = this->pageRect(i);
 
             // The area to paint may be smaller than the total visible area
             if (pageRect.intersects(event->rect())) {
-                if (page->image.isNull())
+                if (geometry(i).isTiled) {
+                    // Fill in around any tiles we don't have yet
+                    if (page->image.isNull())
+                        painter.fillRect(pageRect, Qt::white);
+                    else {
+                        painter.setRenderHint(
+                            QPainter::SmoothPixmapTransform, true);
+                        painter.drawPixmap(pageRect, page->pixmap());
+                    }
+                    const QList<int> tiles = page->tiles.keys();
+                    for (int tile : tiles) {
+                        const QPixmap &pixmap = page->tilePixmap(tile);
+                        painter.drawPixmap(tileTarget(i, tile), pixmap,
+                                           pixmap.rect());
+                    }
+                } else if (page->image.isNull())
                     // Paint a placeholder to reduce flicker
                     painter.fillRect(pageRect, Qt::white);
-                else
-                    painter.drawImage(pageRect, page->image);
+                else {
+                    // Placeholders aren't the same size as the page,
+                    // so they're scaled to fit
+                    painter.setRenderHint(QPainter::SmoothPixmapTransform,
+                                          page->isDraft);
+                    painter.drawPixmap(pageRect, page->pixmap());
+                }
             }
         }
     } else
         event->ignore();
 }
 
-void PagedContent::resizeEvent(QResizeEvent *event)
-{
-    if (updatesEnabled()) {
-        event->accept();
-
-        setPagePositions();
-    } else
-        event->ignore();
-}
-
 /*
  * Adjust this widget's size so it can fit all its content.
  */
 void PagedContent::fitToContent()
 {
-    int w = 0, h = 0, pageCount = pages.count();
+    // setPagePositions() has already done the hard part
+    int w = contentWidth;
+    int h = pages.isEmpty() ? 0 : pageTop(pages.count()) - PAGE_MARGIN;
     QRect visibleArea = visibleRect();
     bool wereUpdatesEnabled = updatesEnabled();
 
-    if (pageCount) {
-        h = (pageCount - 1) * PAGE_MARGIN;
-        for (int i = 0; i < pageCount; i++) {
-            Page *page = pages[i];
-            w = std::max(w, page->width);
-            h += page->height;
-        }
-    }
-
-    // Disable updates so the resize event doesn't call setPagePositions().
-    // It isn't reliably triggered here, so we call it manually after calling
-    // this method to ensure it always happens when we need it to.
+    // Disable updates so resizing doesn't trigger a refresh before we're
+    // ready for it
     setUpdatesEnabled(false);
     setMinimumSize(w, h);
     resize(std::max(w, visibleArea.width()), h);
@@ -249,44 +566,423 @@ void PagedContent::fitToContent()
 
 void PagedContent::purgeCache()
 {
-    for (int i = 0; i < pages.count(); i++)
-        delete pages[i];
     pages.clear();
     pages.squeeze();
-    visiblePages.clear();   // this is small so we don't need to squeeze() it
+    pageSizes.clear();
+    uniformSize = PageGeometry();
+    contentWidth = 0;
+    setPagePositions(0);
+    firstVisible = 0, lastVisible = -1;
+    firstWanted = 0, lastWanted = -1;
+    firstHeld = 0, lastHeld = -1;
 }
 
 /*
- * Recalculate page positions when the widget is resized.
+ * Return the first page that ends below the specified y coordinate,
+ * or the page count if there isn't one.
  */
-void PagedContent::setPagePositions()
+int PagedContent::pageAt(int y) const
 {
-    QRect visibleArea = visibleRect();
+    if (pageTops.isEmpty()) {
+        // Pages of the same size are evenly spaced, so page n ends below
+        // y if n * spacing > y - height
+        int spacing = uniformSize.height + PAGE_MARGIN;
+        int y0 = y - uniformSize.height;
+        return (y0 < 0) ? 0 : std::min(y0 / spacing + 1, (int)pages.count());
+    }
 
-    for (int i = 0, y = 0; i < pages.count(); i++) {
-        Page *page = pages[i];
-        // Center the page if the visible area is wider
-        page->x = std::max(0, (visibleArea.width() - page->width) / 2);
-        page->y = y;
-        y += page->height + PAGE_MARGIN;
+    int first = 0, last = pages.count();
+    while (first < last) {
+        int middle = first + (last - first) / 2;
+        if (pageTops[middle] + pageSizes[middle].height <= y)
+            first = middle + 1;
+        else
+            last = middle;
     }
+    return first;
+}
+
+/*
+ * Return the last page that starts at or above the specified y coordinate,
+ * or -1 if there isn't one.
+ */
+int PagedContent::lastPageAbove(int y) const
+{
+    if (y < 0 || pages.isEmpty())
+        return -1;
+    else if (pageTops.isEmpty())
+        return std::min(y / (uniformSize.height + PAGE_MARGIN),
+                        (int)pages.count() - 1);
+
+    return std::upper_bound(pageTops.constBegin(), pageTops.constEnd() - 1, y)
+           - pageTops.constBegin() - 1;
+}
+
+/*
+ * Return where a page starts, or where one past the last would start.
+ */
+int PagedContent::pageTop(int num) const
+{
+    return pageTops.isEmpty() ? num * (uniformSize.height + PAGE_MARGIN)
+                              : pageTops[num];
+}
+
+/*
+ * Describe how we want the specified page, or part of it, rendered.
+ */
+RenderRequest PagedContent::requestFor(int num, const QRect &region,
+                                       bool draft) const
+{
+    return RenderRequest(num, zoomFactor, logicalDpiX(), logicalDpiY(),
+                         region, draft);
+}
+
+/*
+ * Mark the tiles of a page that intersect the specified area as wanted,
+ * and add requests for any we don't have yet unless requests is null.
+ */
+void PagedContent::requestTiles(int num, const QRect &area,
+                                QList<RenderRequest> *requests)
+{
+    Page *page = &pages[num];
+    QRect pageRect = this->pageRect(num);
+    QRect pageArea = area.intersected(pageRect)
+                         .translated(-pageRect.topLeft());
+    if (pageArea.isEmpty())
+        return;
+
+    // Convert to physical pixels, which is what the tiles are measured in
+    qreal dpRatio = devicePixelRatio();
+    QRect pixelArea(QPoint(pageArea.left() * dpRatio,
+                           pageArea.top() * dpRatio),
+                    QPoint((pageArea.right() + 1) * dpRatio - 1,
+                           (pageArea.bottom() + 1) * dpRatio - 1));
+    const PageGeometry &size = geometry(num);
+    pixelArea &= QRect(QPoint(0, 0), size.pixelSize);
+    if (pixelArea.isEmpty())
+        return;
+
+    int columns = size.tileColumns();
+    for (int row = pixelArea.top() / TILE_SIZE;
+         row <= pixelArea.bottom() / TILE_SIZE; row++) {
+        for (int column = pixelArea.left() / TILE_SIZE;
+             column <= pixelArea.right() / TILE_SIZE; column++) {
+            int index = row * columns + column;
+            page->wantedTiles.insert(index);
+            if (!(page->tiles.contains(index) || restoreImage(num, index))
+                && requests != nullptr)
+                requests->append(requestFor(num, size.tileRect(index)));
+        }
+    }
+}
+
+/*
+ * Identify an image in the page cache.
+ *
+ * Images we have are always rendered with the renderer's current settings,
+ * so we don't need to pass those in.
+ */
+PageCacheKey PagedContent::cacheKey(int num, int tile, qreal dpRatio) const
+{
+    return PageCacheKey(renderer, num, tile, renderer->zoomFactor(),
+                        renderer->dpiX(), renderer->dpiY(), dpRatio);
+}
+
+/*
+ * Move a page's images into the page cache, or only the ones we don't
+ * currently want unless all is true. Drafts aren't worth keeping.
+ */
+void PagedContent::stashImages(int num, bool all)
+{
+    Page *page = &pages[num];
+
+    if (all || !isWanted(num)) {
+        if (!(page->image.isNull() || page->isDraft)) {
+            pageCache.insert(cacheKey(num, -1, page->image.devicePixelRatio()),
+                             page->image);
+        }
+        page->image = QImage();
+        page->isDraft = false;
+        page->releasePixmap();
+    }
+
+    QMap<int, QImage>::iterator tile = page->tiles.begin();
+    while (tile != page->tiles.end()) {
+        if (!all && page->wantedTiles.contains(tile.key()))
+            ++tile;
+        else {
+            pageCache.insert(cacheKey(num, tile.key(),
+                                      tile.value().devicePixelRatio()),
+                             tile.value());
+            tile = page->tiles.erase(tile);
+        }
+    }
+    page->releaseTilePixmaps();
+}
+
+/*
+ * Bring back a page image, or one of its tiles, from the page cache.
+ * Returns true if we had it.
+ */
+bool PagedContent::restoreImage(int num, int tile)
+{
+    QImage image = pageCache.take(cacheKey(num, tile, devicePixelRatio()));
+    if (image.isNull())
+        return false;
+
+    Page *page = &pages[num];
+    if (tile < 0) {
+        page->image = image;
+        page->isDraft = false;
+    } else
+        page->tiles.insert(tile, image);
+    return true;
+}
+
+/*
+ * Decide whether to render a quick draft of a page before the real thing.
+ */
+bool PagedContent::wantsDraft(int num) const
+{
+    if (!renderer->supportsDrafts())
+        return false;
+    else if (renderer->hasInstantDraft(num))
+        return true;
+
+    // If we haven't rendered anything yet, err on the side of showing
+    // something quickly; the draft is cheap compared to a slow page
+    int estimate = renderer->estimatedRenderTime(geometry(num).pixelSize);
+    return (estimate < 0 || estimate > DRAFT_THRESHOLD);
+}
+
+/*
+ * Return where a tile should be painted, in logical pixels.
+ */
+QRectF PagedContent::tileTarget(int num, int index) const
+{
+    qreal dpRatio = devicePixelRatio();
+    QPoint origin = pageRect(num).topLeft();
+    QRect rect = geometry(num).tileRect(index);
+    return QRectF(origin.x() + rect.x() / dpRatio,
+                  origin.y() + rect.y() / dpRatio,
+                  rect.width() / dpRatio, rect.height() / dpRatio);
+}
+
+/*
+ * Recalculate the positions of the pages from the specified one on, when
+ * their sizes change.
+ *
+ * Horizontal positions depend on the viewport's width, so pageRect()
+ * works those out as needed, and resizing the window costs nothing.
+ * So do vertical positions if the pages are all the same size.
+ */
+void PagedContent::setPagePositions(int first)
+{
+    if (pageSizes.isEmpty()) {
+        pageTops.clear();
+        return;
+    }
+
+    pageTops.resize(pages.count() + 1);
+    int y = (first > 0) ? pageTops[first] : 0;
+    for (int i = first; i < pages.count(); i++) {
+        pageTops[i] = y;
+        y += pageSizes[i].height + PAGE_MARGIN;
+    }
+    pageTops[pages.count()] = y;
 }
 
 void PagedContent::setPageImage(int num, const QImage &image)
 {
-    if (0 <= num && num < pages.count()) {
-        Page *page = pages[num];
+    if (0 <= num && num < pages.count() && !geometry(num).isTiled) {
+        Page *page = &pages[num];
         page->image = image;
-        page->isRendering = false;
+        page->isDraft = false;
         // Paint at the correct physical size on high-DPI screens
         page->image.setDevicePixelRatio(devicePixelRatio());
+        // Make sure refresh() finds this when it's time to stash it
+        if (firstHeld > lastHeld)
+            firstHeld = lastHeld = num;
+        else {
+            firstHeld = std::min(firstHeld, num);
+            lastHeld = std::max(lastHeld, num);
+        }
         // We only need to repaint this page; the others are fine
-        update(page->rect());
+        update(pageRect(num));
+    }
+}
+
+/*
+ * Accept a rendered page if it's still what we want.
+ */
+void PagedContent::pageRendered(const RenderRequest &request,
+                                const QImage &image)
+{
+    // Discard pages rendered for an old zoom level
+    if (request != requestFor(request.page, request.region, request.draft))
+        return;
+
+    // Documents tend to be all color or all grayscale, so this is a good
+    // guess at how much memory the next page will take
+    qint64 pixels = (qint64)image.width() * image.height();
+    if (!request.draft && request.region.isNull() && pixels > 0) {
+        qreal bytesPerPixel = (qreal)image.sizeInBytes() / pixels;
+        storedBytesPerPixel = (storedBytesPerPixel == 0)
+            ? bytesPerPixel : (3 * storedBytesPerPixel + bytesPerPixel) / 4;
+    }
+
+    // Keep pages rendered in advance, and pages that scrolled out of view
+    // while they were being rendered, in case the user goes there next
+    if (!isWanted(request.page)) {
+        if (!request.draft && request.region.isNull()) {
+            QImage cached = image;
+            cached.setDevicePixelRatio(devicePixelRatio());
+            pageCache.insert(cacheKey(request.page, -1,
+                                      cached.devicePixelRatio()), cached);
+        }
+        return;
+    }
+
+    Page *page = &pages[request.page];
+    if (request.draft) {
+        // Never replace the real thing with a draft
+        if (!geometry(request.page).isTiled && page->image.isNull()) {
+            page->image = image;
+            page->isDraft = true;
+            page->isPartial = false;
+            update(pageRect(request.page));
+        }
+    } else if (!geometry(request.page).isTiled)
+        setPageImage(request.page, image);
+    else if (!request.region.isNull()) {
+        const QRect &region = request.region;
+        int index = (region.y() / TILE_SIZE)
+                    * geometry(request.page).tileColumns()
+                    + region.x() / TILE_SIZE;
+        if (page->wantedTiles.contains(index)) {
+            QImage tile = image;
+            tile.setDevicePixelRatio(devicePixelRatio());
+            page->tiles.insert(index, tile);
+
+            // Once the tiles cover everything, we can let go of any
+            // placeholder
+            if (page->tiles.size() == page->wantedTiles.size()) {
+                page->image = QImage();
+                page->isDraft = false;
+                page->releasePixmap();
+            }
+            update(tileTarget(request.page, index).toAlignedRect());
+        }
+    }
+}
+
+/*
+ * Show what we have of a slow page while the rest is rendered.
+ */
+void PagedContent::pagePartiallyRendered(const RenderRequest &request,
+                                         const QImage &image)
+{
+    if (request != requestFor(request.page, request.region, request.draft)
+        || !isWanted(request.page))
+        return;
+
+    // Anything that shows the whole page is better than most of it blank,
+    // so this only replaces earlier stages of the same render
+    Page *page = &pages[request.page];
+    if (!geometry(request.page).isTiled && request.region.isNull()
+        && (page->image.isNull() || (page->isDraft && page->isPartial))) {
+        page->image = image;
+        page->image.setDevicePixelRatio(devicePixelRatio());
+        page->isDraft = true;
+        page->isPartial = true;
+        update(pageRect(request.page));
+    }
+}
+
+/*
+ * Lay out the pages again now that the renderer knows their real sizes.
+ */
+void PagedContent::pageSizesChanged()
+{
+    // Cached images may be the wrong shape, and there's no telling which
+    pageCache.removeRenderer(renderer);
+    display();
+}
+
+/*
+ * Render the pages again now that the renderer would draw them
+ * differently. What we have stands in for them until then.
+ */
+void PagedContent::pagesChanged()
+{
+    pageCache.removeRenderer(renderer);
+    for (int i = firstHeld; i <= lastHeld; i++) {
+        Page *page = &pages[i];
+        if (!page->image.isNull()) {
+            page->isDraft = true;
+            page->isPartial = false;
+        }
+        page->tiles.clear();
+        page->releaseTilePixmaps();
+    }
+    refresh();
+}
+
+void PagedContent::stoppedZooming()
+{
+    isZooming = false;
+    refresh();
+    emit zoomSettled();
+}
+
+/*
+ * Render the rest of the document while the user isn't doing anything,
+ * nearest pages first, until they'd take up our share of the page cache.
+ */
+void PagedContent::renderRest()
+{
+    if (renderer == nullptr || firstWanted > lastWanted)
+        return;
+
+    qreal dpRatio = devicePixelRatio();
+    qint64 budget = pageCache.memoryLimit() * IDLE_CACHE_SHARE / 100;
+    QList<RenderRequest> requests;
+
+    // Go in the direction the user was scrolling, then back the other way
+    int step = scrollDirection;
+    int i = (step > 0) ? lastWanted + 1 : firstWanted - 1;
+    bool turnedBack = false;
+    while (budget > 0) {
+        if (i < 0 || i >= pages.count()) {
+            if (turnedBack)
+                break;
+            turnedBack = true;
+            step = -step;
+            i = (step > 0) ? lastWanted + 1 : firstWanted - 1;
+            continue;
+        }
+
+        // Pages big enough to need tiles would crowd out everything else
+        const PageGeometry &size = geometry(i);
+        if (!size.isTiled) {
+            // Go by how compactly the pages so far could be stored, or
+            // assume the worst until we know
+            qreal bytesPerPixel = (storedBytesPerPixel > 0)
+                                  ? storedBytesPerPixel : 4;
+            budget -= (qint64)(bytesPerPixel * size.pixelSize.width()
+                               * size.pixelSize.height());
+            if (budget >= 0 && !pageCache.contains(cacheKey(i, -1, dpRatio)))
+                requests.append(requestFor(i));
+        }
+        i += step;
     }
+
+    scheduler->submit(renderer, RenderScheduler::Background, requests);
 }
 
 void PagedContent::stoppedMoving()
 {
     isMoving = false;
+    scrollSpeed = 0;
     refresh();
 }
@@ -21,69 +21,172 @@
 #define VIEWER_PAGED_H
 
 #include <QObject>
+#include <QElapsedTimer>
 #include <QList>
 #include <QImage>
+#include <QMap>
+#include <QPixmap>
+#include <QRect>
+#include <QSet>
+#include <QSize>
 #include <QTimer>
 
 #include <QWidget>
 #include <QScrollArea>
 #include <QMoveEvent>
 #include <QPaintEvent>
-#include <QResizeEvent>
 
-class PagedContent; // defined below
-struct Page;        // defined in viewer_paged.cpp
+#include "page_cache.h"
 
 class Renderer;
 class PagedContentRenderer;
+class RenderScheduler;
+struct RenderRequest;
+
+/*
+ * How big a page is at the current zoom level.
+ */
+struct PageGeometry {
+    PageGeometry();
+    PageGeometry(const QSize &pixelSize, qreal dpRatio);
+    int tileColumns() const;
+    QRect tileRect(int index) const;
+
+    QSize pixelSize;            // rendered size in physical pixels
+    bool isTiled;
+    int width;                  // in logical pixels
+    int height;
+};
+
+/*
+ * What we know about a page. Its size and position are kept separately by
+ * the PagedContent widget, which can often describe every page at once.
+ */
+struct Page {
+    Page();
+    const QPixmap &pixmap();
+    inline void releasePixmap() { pixmap_ = QPixmap(); }
+    const QPixmap &tilePixmap(int index);
+    void releaseTilePixmaps();
+
+    QImage image;               // the whole page, if it isn't tiled
+    bool isDraft;               // image is a placeholder until the real one
+    bool isPartial;             // the placeholder is the real one, unfinished
+    QMap<int, QImage> tiles;    // otherwise, in row-major order
+    QSet<int> wantedTiles;      // tiles visible or about to be
+
+private:
+    // The image as we paint it, made when it's first needed
+    QPixmap pixmap_;
+    qint64 pixmapSource;        // cacheKey() of the image it came from
+
+    // Likewise for each tile
+    struct TilePixmap {
+        QPixmap pixmap;
+        qint64 source;
+    };
+    QMap<int, TilePixmap> tilePixmaps;
+};
 
 class PagedContent : public QWidget
 {
     Q_OBJECT
 
 public:
-    PagedContent(QScrollArea *parent);
+    PagedContent(RenderScheduler *scheduler, QScrollArea *parent);
     ~PagedContent();
     void setRenderer(Renderer *replacement);
     void setZoomFactor(int percent);
 
+    QMap<int, QImage> pageImages() const;
+    QRect pageRect(int num) const;
+
 public slots:
     void clear();
     void display();
     void refresh();
+    void setPageImage(int num, const QImage &image);
 
 private:
     // Qt events
     void moveEvent(QMoveEvent *event);
     void paintEvent(QPaintEvent *event);
-    void resizeEvent(QResizeEvent *event);
 
     // Other private methods
     void fitToContent();
+    inline bool isWanted(int num) const
+        { return (firstWanted <= num && num <= lastWanted); }
+    inline const PageGeometry &geometry(int num) const
+        { return pageSizes.isEmpty() ? uniformSize : pageSizes[num]; }
+    PageCacheKey cacheKey(int num, int tile, qreal dpRatio) const;
+    void stashImages(int num, bool all);
+    bool restoreImage(int num, int tile);
+    int pageAt(int y) const;
+    int pageTop(int num) const;
+    int lastPageAbove(int y) const;
     void purgeCache();
-    void setPagePositions();
+    RenderRequest requestFor(int num, const QRect &region = QRect(),
+                             bool draft = false) const;
+    void requestTiles(int num, const QRect &area,
+                      QList<RenderRequest> *requests);
+    void setPagePositions(int first);
+    QRectF tileTarget(int num, int index) const;
+    bool wantsDraft(int num) const;
 
     // Area of this widget currently visible in the viewport
     inline QRect visibleRect() const
         { return viewport->rect().translated(-pos()); }
 
     PagedContentRenderer *renderer;
+    RenderScheduler *scheduler;
     QWidget *viewport;
-    QList<Page*> pages;
-    // We use a list rather than a queue for this because Qt may generate
-    // multiple paint events between refresh()es
-    QList<const Page*> visiblePages;
+    QList<Page> pages;
+    // Each page's size, or nothing if they're all uniformSize. Scanned
+    // documents usually are, and then laying them out takes no longer for
+    // thousands of pages than for a few.
+    QList<PageGeometry> pageSizes;
+    PageGeometry uniformSize;
+    // Where each page starts, plus where one past the last would start,
+    // unless pageSizes is empty and we can work that out as needed.
+    // This is sorted, so we can find the visible pages with a binary search
+    // instead of checking every page each time the user scrolls.
+    QList<int> pageTops;
+    int contentWidth;       // of the widest page
+    // Pages to paint; these are updated by refresh() because Qt may
+    // generate multiple paint events in between
+    int firstVisible, lastVisible;
+    // Visible pages plus those about to scroll into view
+    int firstWanted, lastWanted;
+    // Pages that may have images we haven't stashed yet
+    int firstHeld, lastHeld;
+    int scrollDirection;    // 1 for down, -1 for up
+    qreal scrollSpeed;      // in pixels per second, or 0 if we've stopped
+    QElapsedTimer moveClock;
     QTimer *moveTimer;
+    QTimer *idleTimer;
+    QTimer *zoomTimer;
+    // Images we aren't using right now, in case we need them again soon
+    PageCache pageCache;
+    // Average memory per pixel of the pages rendered so far, once stored,
+    // or 0 if there haven't been any yet
+    qreal storedBytesPerPixel;
     int zoomFactor;
     bool isMoving;
-    bool purgeInvisible;
+    bool isZooming;     // placeholders shown until the user stops zooming
 
 private slots:
-    void setPageImage(int num, const QImage &image);
+    void pageRendered(const RenderRequest &request, const QImage &image);
+    void pagePartiallyRendered(const RenderRequest &request,
+                               const QImage &image);
+    void pageSizesChanged();
+    void pagesChanged();
+    void renderRest();
     void stoppedMoving();
+    void stoppedZooming();
 
 signals:
-    void imageRequested(int num);
+    // Emitted once we're rendering at the current zoom level
+    void zoomSettled();
 };
 
 #endif /* VIEWER_PAGED_H */